@@ -0,0 +1,138 @@
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include "storage.h"
+#include "concurrentbptree.h"
+#include "storage.cpp"
+#include "concurrentbptree.cpp"
+
+// Stress benchmark of ConcurrentBPTree: loads the tree from several threads, then measures
+// the throughput of lookups with more and more reader threads, with and without a writer
+// inserting and removing keys at the same time
+
+const int SIZE = 1e8;
+const int BLOCK_SIZE = 200;
+const int NO_OF_RECORDS = 1000000;
+// Keys are spread over this many distinct numVotes values
+const int KEY_RANGE = 200000;
+// Length of each measurement
+const std::chrono::milliseconds RUN_TIME(1000);
+
+// Loads the records into the tree from noOfThreads threads, each inserting a share of them
+double loadTree(ConcurrentBPTree &tree, const std::vector<std::pair<int, std::byte *>> &entries, int noOfThreads) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < noOfThreads; t++) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = t; i < entries.size(); i += noOfThreads) {
+                tree.insert(entries[i].first, entries[i].second);
+            }
+        });
+    }
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs noOfReaders threads doing searchRecords on random keys for RUN_TIME, together with a
+// writer inserting and removing keys above KEY_RANGE if withWriter, returns lookups per second
+// over the time from when all threads are running until they have all stopped
+double measureLookups(ConcurrentBPTree &tree, int noOfReaders, bool withWriter, std::byte *recordPtr) {
+    std::atomic<bool> stop(false);
+    std::atomic<long> noOfLookups(0);
+    // threads wait for go once they are running, so that none starts before the clock
+    std::atomic<int> noOfRunning(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < noOfReaders; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 rng(t);
+            long lookups = 0;
+            noOfRunning++;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            while (!stop.load(std::memory_order_relaxed)) {
+                tree.searchRecords(rng() % KEY_RANGE);
+                lookups++;
+            }
+            noOfLookups += lookups;
+        });
+    }
+    if (withWriter) {
+        threads.emplace_back([&]() {
+            noOfRunning++;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (int key = KEY_RANGE; !stop.load(std::memory_order_relaxed); key++) {
+                tree.insert(key, recordPtr);
+                if (key % 2 == 0) {
+                    tree.remove(key - 1);
+                }
+            }
+        });
+    }
+    while (noOfRunning.load() < (int) threads.size()) {
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(RUN_TIME);
+    stop = true;
+    for (std::thread &thread: threads) {
+        thread.join();
+    }
+    return noOfLookups / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main() {
+    // Synthetic records with random numVotes
+    Storage storage(SIZE, BLOCK_SIZE);
+    std::vector<std::pair<int, std::byte *>> entries;
+    std::mt19937 rng(42);
+    for (int i = 0; i < NO_OF_RECORDS; i++) {
+        Record r;
+        memset(&r, 0, sizeof(r));
+        snprintf(r.tconst, sizeof(r.tconst), "tt%07d", i);
+        r.averageRating = (rng() % 100) / 10.0;
+        r.numVotes = rng() % KEY_RANGE;
+        entries.push_back({r.numVotes, storage.insertRecord(r)});
+    }
+
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int t = 1; t < maxThreads; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::cout << "---Load " << NO_OF_RECORDS << " records---\n";
+    for (int t: threadCounts) {
+        ConcurrentBPTree tree;
+        double seconds = loadTree(tree, entries, t);
+        std::cout << t << " threads: " << NO_OF_RECORDS / seconds / 1e6 << " M inserts/s\n";
+    }
+
+    ConcurrentBPTree tree;
+    loadTree(tree, entries, maxThreads);
+    std::cout << "\nHeight of tree: " << tree.getHeight() << '\n';
+
+    for (int withWriter = 0; withWriter < 2; withWriter++) {
+        std::cout << (withWriter ? "\n---Lookups with a concurrent writer---\n" : "\n---Lookups---\n");
+        double single = 0;
+        for (int t: threadCounts) {
+            double lookups = measureLookups(tree, t, withWriter, entries[0].second);
+            single = single == 0 ? lookups : single;
+            std::cout << t << " readers: " << lookups / 1e6 << " M lookups/s (x" << lookups / single << ")\n";
+        }
+    }
+    return 0;
+}
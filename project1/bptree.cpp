@@ -2,112 +2,494 @@
 #include <stdexcept>
 #include <unordered_set>
 #include <algorithm>
-#include <climits>
+#include <new>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include "bptree.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BPTREE_X86_SIMD
+#endif
 using namespace std;
 
+// In-node key lookup
+// every search returns the number of keys in keys[0..size) that are less than key
+// (orEqual = false) or less than or equal to key (orEqual = true), i.e. the lower or
+// upper bound of key in the sorted keys array
 
-Node::~Node()
+// nodes with more keys than this use the binary search even if SIMD is available
+const int SIMD_SEARCH_MAX_KEYS = 64;
+
+typedef int (*KeySearchFn)(const int *keys, int size, int key, bool orEqual);
+
+// compares key against every key in the node and counts the keys below it
+static int searchKeysLinear(const int *keys, int size, int key, bool orEqual)
 {
+    int count = 0;
+    for (int i = 0; i < size; i++)
+    {
+        count += orEqual ? keys[i] <= key : keys[i] < key;
+    }
+    return count;
 }
 
-Node::Node(int i)
+#ifdef BPTREE_X86_SIMD
+// compare-and-count over 4 keys at a time
+__attribute__((target("sse4.2"))) static int searchKeysSSE4(const int *keys, int size, int key, bool orEqual)
 {
-    keys = new int[i];
-    ptrs = new ptrs_struct[i + 1];
+    __m128i k = _mm_set1_epi32(key);
+    int count = 0, i = 0;
+    for (; i + 4 <= size; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(keys + i));
+        // keys > key are the ones not counted when orEqual, keys < key are the ones counted otherwise
+        __m128i gt = orEqual ? _mm_cmpgt_epi32(v, k) : _mm_cmpgt_epi32(k, v);
+        int matches = __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(gt)));
+        count += orEqual ? 4 - matches : matches;
+    }
+    return count + searchKeysLinear(keys + i, size - i, key, orEqual);
 }
 
-BPTree::BPTree(int BLOCK_SIZE)
+// compare-and-count over 8 keys at a time
+__attribute__((target("avx2"))) static int searchKeysAVX2(const int *keys, int size, int key, bool orEqual)
 {
-    root = NULL;
-    NODE_KEYS=(BLOCK_SIZE-16)/20;
+    __m256i k = _mm256_set1_epi32(key);
+    int count = 0, i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(keys + i));
+        __m256i gt = orEqual ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v);
+        int matches = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(gt)));
+        count += orEqual ? 8 - matches : matches;
+    }
+    return count + searchKeysSSE4(keys + i, size - i, key, orEqual);
 }
+#endif
 
-BPTree::~BPTree()
+// pick the widest compare-and-count kernel supported by the CPU, NULL without SIMD
+static KeySearchFn pickSimdSearch()
 {
-    cleanUp(root);
+#ifdef BPTREE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return searchKeysAVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return searchKeysSSE4;
+    }
+#endif
+    return NULL;
 }
 
-// recursively delete nodes of bptree
-void BPTree::cleanUp(Node *cursor)
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+bool BPTree<Key, BlockSize, Compare, Augmented>::keyLess(const Key &a, const Key &b)
 {
-    // cout << "Cleaning up bptree" << endl;
-    if (cursor != NULL)
+    return Compare()(a, b);
+}
+
+// keys are equal when neither orders before the other
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+bool BPTree<Key, BlockSize, Compare, Augmented>::keyEqual(const Key &a, const Key &b)
+{
+    return !keyLess(a, b) && !keyLess(b, a);
+}
+
+// number of keys in keys[0..size) that order before key (orEqual = false) or not after it
+// (orEqual = true), picked at compile time for the key type of the tree:
+// in nodes of up to SIMD_SEARCH_MAX_KEYS keys, int keys in their natural order use the SIMD
+// searches above and other arithmetic keys in their natural order a compare-and-count over the
+// keys of the node (a loop the compiler can vectorize), anything else the branchless binary
+// search with Compare
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+int BPTree<Key, BlockSize, Compare, Augmented>::searchNodeKeys(const Key *keys, int size, Key key, bool orEqual)
+{
+    if constexpr (std::is_same<Key, int>::value && std::is_same<Compare, std::less<int>>::value)
     {
-        if (!cursor->isLeaf)
+        static const KeySearchFn simdSearch = pickSimdSearch();
+        if (simdSearch != NULL && size <= SIMD_SEARCH_MAX_KEYS)
         {
-            for (int i = 0; i < cursor->size + 1; i++)
+            return simdSearch(keys, size, key, orEqual);
+        }
+    }
+    else if constexpr (std::is_arithmetic<Key>::value && std::is_same<Compare, std::less<Key>>::value)
+    {
+        if (size <= SIMD_SEARCH_MAX_KEYS)
+        {
+            int count = 0;
+            for (int i = 0; i < size; i++)
             {
-                cleanUp((Node *)cursor->ptrs[i].nodePtr);
+                count += orEqual ? keys[i] <= key : keys[i] < key;
             }
+            return count;
         }
-        // cout << "deleting node starting with key " << cursor->keys[0] << endl;
-        delete[] cursor->keys;
-        delete[] cursor->ptrs;
-        delete cursor;
     }
+
+    // branchless binary search, the loop only narrows down base with a conditional move
+    if (size == 0)
+    {
+        return 0;
+    }
+    const Key *base = keys;
+    int n = size;
+    while (n > 1)
+    {
+        int half = n / 2;
+        bool below = orEqual ? !keyLess(key, base[half]) : keyLess(base[half], key);
+        base = below ? base + half : base;
+        n -= half;
+    }
+    bool below = orEqual ? !keyLess(key, *base) : keyLess(*base, key);
+    return (base - keys) + below;
+}
+
+// index of the first key that is not less than key
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+int BPTree<Key, BlockSize, Compare, Augmented>::lowerBound(const Key *keys, int size, Key key)
+{
+    return searchNodeKeys(keys, size, key, false);
+}
+
+// index of the first key that is greater than key, which is also the index of the
+// child to follow in an internal node
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+int BPTree<Key, BlockSize, Compare, Augmented>::upperBound(const Key *keys, int size, Key key)
+{
+    return searchNodeKeys(keys, size, key, true);
+}
+
+template <typename Key, int Capacity>
+Node<Key, Capacity>::Node(bool isLeaf, PageId pageId)
+{
+    this->size = 0;
+    this->capacity = Capacity;
+    this->isLeaf = isLeaf;
+    this->pageId = pageId;
+    this->next = NO_PAGE;
+}
+
+// keys start right after the header
+template <typename Key, int Capacity>
+Key *Node<Key, Capacity>::keys()
+{
+    return (Key *)(this + 1);
+}
+
+// child page ids and records start after the keys, rounded up to the alignment of the records
+template <typename Key, int Capacity>
+PageId *Node<Key, Capacity>::children()
+{
+    const int keyBytes = (Capacity * sizeof(Key) + alignof(RecordsRef) - 1) / alignof(RecordsRef) * alignof(RecordsRef);
+    return (PageId *)((char *)keys() + keyBytes);
+}
+
+template <typename Key, int Capacity>
+RecordsRef *Node<Key, Capacity>::records()
+{
+    return (RecordsRef *)children();
+}
+
+// aggregates of an augmented tree start after room for Capacity + 1 records
+template <typename Key, int Capacity>
+Aggregate *Node<Key, Capacity>::aggregates()
+{
+    return (Aggregate *)(records() + Capacity + 1);
 }
 
-// Search operation for insert
-Node *BPTree::search(int key)
+// a tree kept in memory, indexing the records of storage
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+BPTree<Key, BlockSize, Compare, Augmented>::BPTree(Storage &storage) : pages(storage.getBlockSize()), postings(&pages)
 {
-    if (root == NULL)
+    this->storage = &storage;
+    init();
+}
+
+// a tree kept in the page file at path, indexing the records of storage
+// an existing file is reopened, its nodes are only read in when a search reaches them and
+// at most noOfFrames pages stay in memory
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+BPTree<Key, BlockSize, Compare, Augmented>::BPTree(Storage &storage, const char *path, int noOfFrames) : pages(path, storage.getBlockSize(), noOfFrames), postings(&pages)
+{
+    if (noOfFrames < MIN_BUFFER_FRAMES)
+    {
+        throw std::invalid_argument("Buffer pool too small for a B+ tree");
+    }
+    this->storage = &storage;
+    init();
+}
+
+// checks that nodes fit the blocks of the storage, then creates the meta page of a new page
+// file or reads it back
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::init()
+{
+    writing = false;
+    if (pages.getPageSize() != BLOCK_SIZE)
+    {
+        throw std::invalid_argument("Block size of the storage does not match the B+ tree");
+    }
+
+    if (pages.getNoOfPages() == META_PAGE)
+    {
+        pages.allocatePage();
+        root = NO_PAGE;
+        return;
+    }
+    TreeMeta meta;
+    memcpy(&meta, pages.getPage(META_PAGE), sizeof(meta));
+    if (meta.nodeKeys != NODE_KEYS || meta.augmented != augmented || meta.keySize != (int)sizeof(Key))
+    {
+        throw std::runtime_error("Index file was written with another node layout");
+    }
+    root = meta.root;
+    postings = PostingPool(&pages, meta.noOfPostingPages);
+}
+
+// records the root and the number of posting pages in the meta page
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::writeMeta()
+{
+    TreeMeta meta = {NODE_KEYS, root, postings.getUsedPages(), augmented, (int)sizeof(Key)};
+    memcpy(pages.getPage(META_PAGE, true), &meta, sizeof(meta));
+}
+
+// writes the tree back to its page file, does nothing for a tree in memory
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::sync()
+{
+    writeMeta();
+    pages.flush();
+}
+
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+BPTree<Key, BlockSize, Compare, Augmented>::PinScope::PinScope(BPTree *tree, bool writing)
+{
+    this->tree = tree;
+    this->firstPin = tree->pinnedPages.size();
+    this->wasWriting = tree->writing;
+    tree->writing = tree->writing || writing;
+}
+
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+BPTree<Key, BlockSize, Compare, Augmented>::PinScope::~PinScope()
+{
+    for (size_t i = firstPin; i < tree->pinnedPages.size(); i++)
+    {
+        tree->pages.unpinPage(tree->pinnedPages[i], tree->writing);
+    }
+    tree->pinnedPages.resize(firstPin);
+    tree->writing = wasWriting;
+}
+
+// get a node from its page id, reading it in if needed
+// the node stays pinned until it is released or the running operation ends
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+auto BPTree<Key, BlockSize, Compare, Augmented>::getNode(PageId pageId) -> Node *
+{
+    if (pageId == NO_PAGE)
     {
-        // cout << "Tree is empty\n";
         return NULL;
     }
-    else
+    Node *node = (Node *)pages.pinPage(pageId);
+    pinnedPages.push_back(pageId);
+    return node;
+}
+
+// unpin a node before the running operation ends, the node must not be used afterwards
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::releaseNode(Node *node)
+{
+    auto pin = find(pinnedPages.rbegin(), pinnedPages.rend(), node->pageId);
+    pinnedPages.erase(next(pin).base());
+    pages.unpinPage(node->pageId, writing);
+}
+
+// step to the next leaf of the chain, releasing the current one
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+auto BPTree<Key, BlockSize, Compare, Augmented>::nextLeaf(Node *leaf) -> Node *
+{
+    Node *next = getNode(leaf->next);
+    releaseNode(leaf);
+    return next;
+}
+
+// allocate a node as a single page of BLOCK_SIZE bytes
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+auto BPTree<Key, BlockSize, Compare, Augmented>::createNode(bool isLeaf) -> Node *
+{
+    PageId pageId = pages.allocatePage();
+    return new (getNode(pageId)) Node(isLeaf, pageId);
+}
+
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::destroyNode(Node *node)
+{
+    pages.freePage(node->pageId);
+}
+
+// add a record to the records of a key, a key with a single record moves to a posting list
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::addRecord(RecordsRef &records, RecordId recordId)
+{
+    if (!(records & POSTING_FLAG))
     {
-        Node *cursor = root;
-        // find leaf node which may contain key
-        while (cursor->isLeaf == false)
+        PageId headPage = postings.create(records);
+        records = POSTING_FLAG | headPage;
+    }
+    postings.append(records & ~POSTING_FLAG, recordId);
+}
+
+// append the records of a key to recordList, returns the number of posting pages read
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+int BPTree<Key, BlockSize, Compare, Augmented>::getRecords(RecordsRef records, vector<byte *> &recordList)
+{
+    if (!(records & POSTING_FLAG))
+    {
+        recordList.push_back(storage->getRecordPtr(records));
+        return 0;
+    }
+    vector<RecordId> recordIds;
+    postings.getRecords(records & ~POSTING_FLAG, recordIds);
+    for (RecordId recordId : recordIds)
+    {
+        recordList.push_back(storage->getRecordPtr(recordId));
+    }
+    return postings.getNoOfPages(records & ~POSTING_FLAG);
+}
+
+// free the posting pages of a removed key
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::releaseRecords(RecordsRef records)
+{
+    if (records & POSTING_FLAG)
+    {
+        postings.release(records & ~POSTING_FLAG);
+    }
+}
+
+// total of the aggregates of a node, i.e. the aggregate of its subtree
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+Aggregate BPTree<Key, BlockSize, Compare, Augmented>::getAggregate(Node *node)
+{
+    Aggregate total = {0, 0};
+    if (augmented)
+    {
+        int noOfEntries = node->isLeaf ? node->size : node->size + 1;
+        for (int i = 0; i < noOfEntries; i++)
         {
-            for (int i = 0; i < cursor->size; i++)
+            total.count += node->aggregates()[i].count;
+            total.sum += node->aggregates()[i].sum;
+        }
+    }
+    return total;
+}
+
+// the aggregate helpers below do nothing in a tree that is not augmented
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::setAggregate(Node *node, int index, Aggregate aggregate)
+{
+    if (augmented)
+    {
+        node->aggregates()[index] = aggregate;
+    }
+}
+
+// add (sign = 1) or subtract (sign = -1) delta to the aggregate at index
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::addAggregate(Node *node, int index, Aggregate delta, int sign)
+{
+    if (augmented)
+    {
+        node->aggregates()[index].count += sign * delta.count;
+        node->aggregates()[index].sum += sign * delta.sum;
+    }
+}
+
+// move count aggregates along with the keys, records or children they belong to
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::moveAggregates(Node *to, int toIndex, Node *from, int fromIndex, int count)
+{
+    if (augmented && count > 0)
+    {
+        memmove(to->aggregates() + toIndex, from->aggregates() + fromIndex, count * sizeof(Aggregate));
+    }
+}
+
+// the pages of a tree in memory are freed with its page file, a page file is written back
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+BPTree<Key, BlockSize, Compare, Augmented>::~BPTree()
+{
+    writeMeta();
+}
+
+// recursively delete nodes of bptree
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::cleanUp(Node *cursor)
+{
+    // cout << "Cleaning up bptree" << endl;
+    if (cursor != NULL)
+    {
+        PinScope scope(this, true);
+        cursor = getNode(cursor->pageId);
+        if (!cursor->isLeaf)
+        {
+            for (int i = 0; i < cursor->size + 1; i++)
             {
-                if (key < cursor->keys[i])
-                {
-                    cursor = (Node *)cursor->ptrs[i].nodePtr;
-                    break;
-                }
-                if (i == cursor->size - 1)
-                {
-                    cursor = (Node *)cursor->ptrs[i + 1].nodePtr;
-                    break;
-                }
+                cleanUp(getNode(cursor->children()[i]));
             }
         }
-        // find key in leaf node
-        for (int i = 0; i < cursor->size; i++)
+        else
         {
-            if (cursor->keys[i] == key)
+            for (int i = 0; i < cursor->size; i++)
             {
-                // cout << "Found\n";
-                return (Node *)cursor;
+                releaseRecords(cursor->records()[i]);
             }
         }
-        // cout << "Not found\n";
-        return NULL;
+        // cout << "deleting node starting with key " << cursor->keys()[0] << endl;
+        destroyNode(cursor);
     }
 }
 
+// Search operation for insert and remove
+// finds the leaf node which may contain key, recording the node and the index of the child
+// followed at every internal level in path, depth is the number of internal levels
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+auto BPTree<Key, BlockSize, Compare, Augmented>::findLeaf(Key key, PathEntry *path, int &depth) -> Node *
+{
+    Node *cursor = getNode(root);
+    depth = 0;
+    while (cursor->isLeaf == false)
+    {
+        int i = upperBound(cursor->keys(), cursor->size, key);
+        path[depth].node = cursor;
+        path[depth].childIndex = i;
+        depth++;
+        cursor = getNode(cursor->children()[i]);
+    }
+    return cursor;
+}
+
 // Search operation for a key
-vector<byte *> BPTree::searchRecords(int key)
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+vector<byte *> BPTree<Key, BlockSize, Compare, Augmented>::searchRecords(Key key)
 {
     bool found = false;
-    vector<vector<int>> indexes;
+    vector<vector<Key>> indexes;
     int noOfIndexes = 0;
-    vector<int> newIndex;
+    int noOfPostingPages = 0;
+    vector<Key> newIndex;
     vector<byte *> recordList;
-    if (root == NULL)
+    PinScope scope(this, false);
+    long hits = pages.getNoOfHits(), reads = pages.getNoOfReads();
+    if (root == NO_PAGE)
     {
         // cout << "Tree is empty\n";
     }
     else
     {
-        Node *cursor = root;
+        Node *cursor = getNode(root);
         // find leaf node which may contain key
         while (cursor->isLeaf == false)
         {
@@ -116,583 +498,879 @@ vector<byte *> BPTree::searchRecords(int key)
             newIndex.clear();
             for (int i = 0; i < cursor->size; i++)
             {
-                newIndex.push_back(cursor->keys[i]);
+                newIndex.push_back(cursor->keys()[i]);
             }
             indexes.push_back(newIndex);
 
-            for (int i = 0; i < cursor->size; i++)
-            {
-                if (key < cursor->keys[i])
-                {
-                    cursor = (Node *)cursor->ptrs[i].nodePtr;
-                    break;
-                }
-                if (i == cursor->size - 1)
-                {
-                    cursor = (Node *)cursor->ptrs[i + 1].nodePtr;
-                    break;
-                }
-            }
+            Node *child = getNode(cursor->children()[upperBound(cursor->keys(), cursor->size, key)]);
+            releaseNode(cursor);
+            cursor = child;
         }
         // capturing leaf node's contents
         noOfIndexes++;
         newIndex.clear();
         for (int i = 0; i < cursor->size; i++)
         {
-            newIndex.push_back(cursor->keys[i]);
+            newIndex.push_back(cursor->keys()[i]);
         }
         indexes.push_back(newIndex);
 
         // find key in leaf node
-        for (int i = 0; i < cursor->size; i++)
+        int i = lowerBound(cursor->keys(), cursor->size, key);
+        if (i < cursor->size && keyEqual(cursor->keys()[i], key))
         {
-            if (cursor->keys[i] == key)
-            {
-                // cout << "Found\n";
-                found = true;
-                recordList = cursor->ptrs[i].recordPtrs;
-                break;
-            }
+            // cout << "Found\n";
+            found = true;
+            noOfPostingPages += getRecords(cursor->records()[i], recordList);
         }
         if (!found)
         {
             // cout << "Not found\n";
         }
     }
-    cout << "Number of index blocks accessed: " << indexes.size() << endl;
-    for (int i = 0; i < indexes.size() && i < 5; i++)
-    {
-        cout << "Contents of index block " << i << ":" << endl;
-        for (int j = 0; j < indexes[i].size(); j++)
-        {
-            cout << indexes[i][j] << ", ";
-        }
-        cout << "\n";
-    }
+    printAccessStats(indexes.size(), noOfPostingPages, indexes, hits, reads);
     // cout << "Returned recordList size: " << recordList.size() << endl;
     return recordList;
 }
 
 // search Range operation
-vector<byte *> BPTree::searchRange(int startKey, int endKey)
+// collects the records of all keys in [startKey, endKey], streaming callers use seek instead
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+vector<byte *> BPTree<Key, BlockSize, Compare, Augmented>::searchRange(Key startKey, Key endKey)
 {
-    bool found = false;
-    bool end = false;
-    int startPos;
-    vector<vector<int>> indexes;
-    int noOfIndexes = 0;
-    vector<int> newIndex;
     vector<byte *> recordList;
-    if (root == NULL)
+    RangeCursor cursor = seek(startKey, endKey);
+    for (byte *recordPtr = cursor.next(); recordPtr != NULL; recordPtr = cursor.next())
     {
-        // cout << "Tree is empty\n";
+        recordList.push_back(recordPtr);
     }
-    else
+    cursor.printAccessStats();
+    return recordList;
+}
+
+// position a cursor before the first record with a key in [startKey, endKey]
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+auto BPTree<Key, BlockSize, Compare, Augmented>::seek(Key startKey, Key endKey) -> RangeCursor
+{
+    RangeCursor cursor(this, endKey);
+    if (root == NO_PAGE)
     {
-        Node *cursor = root;
-        // find leaf node which may contain startKey
-        while (cursor->isLeaf == false)
+        return cursor;
+    }
+    PinScope scope(this, false);
+    Node *node = getNode(root);
+    // find leaf node which may contain startKey
+    while (node->isLeaf == false)
+    {
+        cursor.visit(node);
+        Node *child = getNode(node->children()[upperBound(node->keys(), node->size, startKey)]);
+        releaseNode(node);
+        node = child;
+    }
+    cursor.visit(node);
+    cursor.moveTo(node);
+    cursor.keyIndex = lowerBound(node->keys(), node->size, startKey);
+    return cursor;
+}
+
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+BPTree<Key, BlockSize, Compare, Augmented>::RangeCursor::RangeCursor(BPTree *tree, Key endKey)
+{
+    this->tree = tree;
+    this->endKey = endKey;
+    this->leaf = NULL;
+    this->keyIndex = 0;
+    this->postingPage = NO_PAGE;
+    this->postingIndex = 0;
+    this->noOfIndexBlocks = 0;
+    this->noOfPostingPages = 0;
+    this->hits = tree->pages.getNoOfHits();
+    this->reads = tree->pages.getNoOfReads();
+}
+
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+BPTree<Key, BlockSize, Compare, Augmented>::RangeCursor::RangeCursor(RangeCursor &&other)
+    : tree(other.tree), endKey(other.endKey), leaf(other.leaf), keyIndex(other.keyIndex),
+      postingPage(other.postingPage), postingIndex(other.postingIndex),
+      noOfIndexBlocks(other.noOfIndexBlocks), noOfPostingPages(other.noOfPostingPages),
+      indexContents(std::move(other.indexContents)), hits(other.hits), reads(other.reads)
+{
+    // the pin of the leaf moves along
+    other.leaf = NULL;
+}
+
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+BPTree<Key, BlockSize, Compare, Augmented>::RangeCursor::~RangeCursor()
+{
+    moveTo(NULL);
+}
+
+// count a node read by the cursor, capturing the keys of the first ones
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::RangeCursor::visit(Node *node)
+{
+    noOfIndexBlocks++;
+    if (indexContents.size() < REPORTED_INDEX_BLOCKS)
+    {
+        indexContents.push_back(vector<Key>(node->keys(), node->keys() + node->size));
+    }
+}
+
+// make node the current leaf, keeping it pinned until the cursor leaves it
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::RangeCursor::moveTo(Node *node)
+{
+    if (node != NULL)
+    {
+        tree->pages.pinPage(node->pageId);
+    }
+    if (leaf != NULL)
+    {
+        tree->pages.unpinPage(leaf->pageId, false);
+    }
+    leaf = node;
+    keyIndex = 0;
+}
+
+// the next record of the range, NULL once the range is exhausted
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+byte * BPTree<Key, BlockSize, Compare, Augmented>::RangeCursor::next()
+{
+    while (true)
+    {
+        // a key with duplicates: go through its posting list one page at a time
+        if (postingPage != NO_PAGE)
         {
-            // capturing index node's contents
-            noOfIndexes++;
-            newIndex.clear();
-            for (int i = 0; i < cursor->size; i++)
+            if (postingIndex < tree->postings.getNoOfRecordsInPage(postingPage))
             {
-                newIndex.push_back(cursor->keys[i]);
+                return tree->storage->getRecordPtr(tree->postings.getRecordInPage(postingPage, postingIndex++));
             }
-            indexes.push_back(newIndex);
-
-            for (int i = 0; i < cursor->size; i++)
+            postingPage = tree->postings.getNextPage(postingPage);
+            postingIndex = 0;
+            if (postingPage != NO_PAGE)
             {
-                if (startKey < cursor->keys[i])
-                {
-                    cursor = (Node *)cursor->ptrs[i].nodePtr;
-                    break;
-                }
-                if (i == cursor->size - 1)
-                {
-                    cursor = (Node *)cursor->ptrs[i + 1].nodePtr;
-                    break;
-                }
+                noOfPostingPages++;
             }
+            continue;
         }
-        // capturing leaf node's contents
-        noOfIndexes++;
-        newIndex.clear();
-        for (int i = 0; i < cursor->size; i++)
+        if (leaf == NULL)
         {
-            newIndex.push_back(cursor->keys[i]);
+            return NULL;
         }
-        indexes.push_back(newIndex);
-
-        // find startKey in leaf node
-        for (int i = 0; i < cursor->size; i++)
+        // past the last key of the leaf, continue in the next leaf of the chain
+        if (keyIndex == leaf->size)
         {
-            if (cursor->keys[i] >= startKey)
+            PinScope scope(tree, false);
+            Node *next = tree->getNode(leaf->next);
+            if (next != NULL)
             {
-                // cout << "Found first record\n";
-                found = true;
-                recordList = cursor->ptrs[i].recordPtrs;
-                startPos = i;
-                break;
-            }
-        }
-        // if startKey not found in the leaf node, try next leaf node
-        if (!found)
-        {
-            // capture index node contents
-
-            cursor = (Node *)cursor->ptrs[NODE_KEYS].nodePtr;
-            if (cursor != NULL)
-            {
-                noOfIndexes++;
-                newIndex.clear();
-                for (int i = 0; i < cursor->size; i++)
-                {
-                    newIndex.push_back(cursor->keys[i]);
-                }
-                indexes.push_back(newIndex);
-
-                recordList = cursor->ptrs[0].recordPtrs;
-                startPos = 0;
-                // cout << "Found first record\n";
-                found = true;
+                visit(next);
             }
+            moveTo(next);
+            continue;
         }
-        if (!found)
+        if (keyLess(endKey, leaf->keys()[keyIndex]))
         {
-            // cout << "No records found in this range\n";
+            moveTo(NULL);
+            return NULL;
         }
-        // get all records in the range [startKey,endKey]
-        // iterate through current index node
-        if (found)
+        RecordsRef records = leaf->records()[keyIndex++];
+        if (!(records & POSTING_FLAG))
         {
-            for (int i = startPos + 1; i < cursor->size; i++)
-            {
-                if (cursor->keys[i] <= endKey)
-                {
-                    recordList.insert(recordList.end(), cursor->ptrs[i].recordPtrs.begin(), cursor->ptrs[i].recordPtrs.end());
-                }
-                else
-                {
-                    end = true;
-                    break;
-                }
-            }
-            if (!end)
-            {
-                // iterate through adjacent index nodes
-                cursor = (Node *)cursor->ptrs[NODE_KEYS].nodePtr;
-                int i = 0;
-                if (cursor != NULL)
-                {
-                    noOfIndexes++;
-                    newIndex.clear();
-                    for (int i = 0; i < cursor->size; i++)
-                    {
-                        newIndex.push_back(cursor->keys[i]);
-                    }
-                    indexes.push_back(newIndex);
-                }
-                while (cursor != NULL && cursor->keys[i] <= endKey)
-                {
-                    recordList.insert(recordList.end(), cursor->ptrs[i].recordPtrs.begin(), cursor->ptrs[i].recordPtrs.end());
-                    i++;
-                    if (i == cursor->size)
-                    {
-                        cursor = (Node *)cursor->ptrs[NODE_KEYS].nodePtr;
-                        i = 0;
-                        if (cursor != NULL)
-                        {
-                            noOfIndexes++;
-                            newIndex.clear();
-                            for (int i = 0; i < cursor->size; i++)
-                            {
-                                newIndex.push_back(cursor->keys[i]);
-                            }
-                            indexes.push_back(newIndex);
-                        }
-                    }
-                }
-            }
+            return tree->storage->getRecordPtr(records);
         }
+        postingPage = records & ~POSTING_FLAG;
+        postingIndex = 0;
+        noOfPostingPages++;
     }
-    cout << "Number of index blocks accessed: " << indexes.size() << endl;
-    for (int i = 0; i < indexes.size() && i < 5; i++)
+}
+
+// print the blocks read so far, like the searches of the tree
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::RangeCursor::printAccessStats()
+{
+    tree->printAccessStats(noOfIndexBlocks, noOfPostingPages, indexContents, hits, reads);
+}
+
+// print the index and posting blocks a search read, the buffer pool hits and misses since
+// the search started and the keys of the first index blocks read
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::printAccessStats(int noOfIndexBlocks, int noOfPostingPages, const vector<vector<Key>> &indexContents, long hits, long reads)
+{
+    cout << "Number of index blocks accessed: " << noOfIndexBlocks << endl;
+    cout << "Number of posting blocks accessed: " << noOfPostingPages << endl;
+    if (pages.isFileBacked())
+    {
+        cout << "Index buffer pool: " << pages.getNoOfHits() - hits << " hits, "
+             << pages.getNoOfReads() - reads << " misses (physical reads)" << endl;
+    }
+    for (size_t i = 0; i < indexContents.size() && i < (size_t)REPORTED_INDEX_BLOCKS; i++)
     {
         cout << "Contents of index block " << i << ":" << endl;
-        for (int j = 0; j < indexes[i].size(); j++)
+        for (size_t j = 0; j < indexContents[i].size(); j++)
         {
-            cout << indexes[i][j] << ", ";
+            cout << indexContents[i][j] << ", ";
         }
         cout << "\n";
     }
-    return recordList;
+}
+
+// aggregate of the records with a key less than key (orEqual = false) or less than or equal
+// to key (orEqual = true), adding up the entries left of a single root-to-leaf path
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+Aggregate BPTree<Key, BlockSize, Compare, Augmented>::prefixAggregate(Key key, bool orEqual)
+{
+    Aggregate total = {0, 0};
+    if (root == NO_PAGE)
+    {
+        return total;
+    }
+    PinScope scope(this, false);
+    Node *cursor = getNode(root);
+    while (cursor->isLeaf == false)
+    {
+        // every key in the children before the one followed is less than key
+        int i = upperBound(cursor->keys(), cursor->size, key);
+        for (int j = 0; j < i; j++)
+        {
+            total.count += cursor->aggregates()[j].count;
+            total.sum += cursor->aggregates()[j].sum;
+        }
+        Node *child = getNode(cursor->children()[i]);
+        releaseNode(cursor);
+        cursor = child;
+    }
+    int n = orEqual ? upperBound(cursor->keys(), cursor->size, key) : lowerBound(cursor->keys(), cursor->size, key);
+    for (int j = 0; j < n; j++)
+    {
+        total.count += cursor->aggregates()[j].count;
+        total.sum += cursor->aggregates()[j].sum;
+    }
+    return total;
+}
+
+// number and rating sum of the records with a key in [startKey, endKey], read from the
+// aggregates of O(log n) nodes without touching the records
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+Aggregate BPTree<Key, BlockSize, Compare, Augmented>::aggregateRange(Key startKey, Key endKey)
+{
+    if (!augmented)
+    {
+        throw std::logic_error("Range aggregates require an augmented tree");
+    }
+    Aggregate total = {0, 0};
+    if (keyLess(endKey, startKey))
+    {
+        return total;
+    }
+    Aggregate upTo = prefixAggregate(endKey, true);
+    Aggregate below = prefixAggregate(startKey, false);
+    total.count = upTo.count - below.count;
+    total.sum = upTo.sum - below.sum;
+    return total;
 }
 
 // Insert Operation
-void BPTree::insert(int key, byte *recordAdd)
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::insert(Key key, byte *recordAdd)
 {
-    if (root == NULL) // if no root
+    RecordId recordId = storage->getRecordId(recordAdd);
+    // the record adds itself to the aggregates of its key and of every entry above it
+    Aggregate delta = {1, augmented ? storage->viewRecord(recordAdd).averageRating() : 0};
+    PinScope scope(this, true);
+    if (root == NO_PAGE) // if no root
     {
-        void *test;
-        root = new Node(NODE_KEYS);
-        root->keys[0] = key;
-        // insert adress of record insertion point 1
-        root->ptrs[0].recordPtrs.push_back(recordAdd);
-        root->isLeaf = true;
-        root->size = 1;
+        Node *rootNode = createNode(true);
+        rootNode->keys()[0] = key;
+        // insert id of record insertion point 1
+        rootNode->records()[0] = recordId;
+        setAggregate(rootNode, 0, delta);
+        rootNode->size = 1;
+        root = rootNode->pageId;
     }
     else // if root exsists
     {
-        Node *cursor = root;
-        Node *parent;
-        // check if key already exist in b+ tree
-        Node *searchKey;
-        searchKey = search(key);
+        // traverse to the leaf level, remembering the path for the splits
+        PathEntry path[MAX_TREE_HEIGHT];
+        int depth;
+        Node *cursor = findLeaf(key, path, depth);
+        for (int level = 0; level < depth; level++)
+        {
+            addAggregate(path[level].node, path[level].childIndex, delta, 1);
+        }
+        int i = lowerBound(cursor->keys(), cursor->size, key); // find the index of the first key that is larger than x
         // if key already exist in b+ tree
-        if (searchKey != nullptr)
+        if (i < cursor->size && keyEqual(cursor->keys()[i], key))
         {
-            for (int i = 0; i < searchKey->size; i++)
-            {
-                if (searchKey->keys[i] == key)
-                {
-                    searchKey->ptrs[i].recordPtrs.push_back(recordAdd);
-                    break;
-                }
-            }
+            addRecord(cursor->records()[i], recordId);
+            addAggregate(cursor, i, delta, 1);
             return;
         }
 
         // if key does not already exist in b+ tree
-        while (cursor->isLeaf == false) // traverse to the leaf level
-        {
-            parent = cursor;
-            for (int i = 0; i < cursor->size; i++)
-            {
-                if (key < cursor->keys[i])
-                {
-                    cursor = (Node *)cursor->ptrs[i].nodePtr;
-                    break;
-                }
-                if (i == cursor->size - 1)
-                {
-                    cursor = (Node *)cursor->ptrs[i + 1].nodePtr;
-                    break;
-                }
-            }
-        }
         if (cursor->size < NODE_KEYS) // if this leaf node is not full
         {
-            int i = 0;
-            while (key > cursor->keys[i] && i < cursor->size) // find the index of the first key that is larger than x
-                i++;
-            for (int j = cursor->size; j > i; j--) // copy the keys from the back to make space for new key insertion point
-            {
-                cursor->keys[j] = cursor->keys[j - 1];
-                cursor->ptrs[j] = cursor->ptrs[j - 1];
-            }
+            // shift the keys and records from the back to make space for new key insertion point
+            memmove(cursor->keys() + i + 1, cursor->keys() + i, (cursor->size - i) * sizeof(Key));
+            memmove(cursor->records() + i + 1, cursor->records() + i, (cursor->size - i) * sizeof(RecordsRef));
+            moveAggregates(cursor, i + 1, cursor, i, cursor->size - i);
 
-            cursor->keys[i] = key;
-            ptrs_struct newptr;
-            newptr.recordPtrs.push_back(recordAdd);
-            cursor->ptrs[i] = newptr;
+            cursor->keys()[i] = key;
+            cursor->records()[i] = recordId;
+            setAggregate(cursor, i, delta);
             cursor->size++;
-            // cursor->ptrs[cursor->size] = cursor->ptrs[cursor->size - 1]; // update the pointer to next leaf
-            // cursor->ptrs[cursor->size - 1] = NULL;
         }
         else // if the leaf node is full
         {
-            Node *newLeaf = new Node(NODE_KEYS);
-            // int virtualNode[MAX + 1]; // create an array of size max+1 to store the keys, including the new key
-            Node *virtualNode = new Node(NODE_KEYS + 1); // create a virtualnode with 1 more key+pointer
-            // copy contents of current leaf node to virtualNode
-            for (int i = 0; i < NODE_KEYS; i++)
+            Node *newLeaf = createNode(true);
+            // create arrays with 1 more key+pointer to store the keys, including the new key
+            Key virtualKey[NODE_KEYS + 1];
+            RecordsRef virtualRecords[NODE_KEYS + 1];
+            // copy contents of current leaf node to the virtual arrays, leaving a gap for the new key at i
+            memcpy(virtualKey, cursor->keys(), i * sizeof(Key));
+            memcpy(virtualRecords, cursor->records(), i * sizeof(RecordsRef));
+            memcpy(virtualKey + i + 1, cursor->keys() + i, (NODE_KEYS - i) * sizeof(Key));
+            memcpy(virtualRecords + i + 1, cursor->records() + i, (NODE_KEYS - i) * sizeof(RecordsRef));
+            virtualKey[i] = key; // replace key
+            virtualRecords[i] = recordId; // replace record id
+            Aggregate virtualAggregates[NODE_KEYS + 1];
+            if (augmented)
             {
-                // virtualNode[i] = cursor->key[i];
-                virtualNode->keys[i] = cursor->keys[i];
-                virtualNode->ptrs[i] = cursor->ptrs[i];
+                memcpy(virtualAggregates, cursor->aggregates(), i * sizeof(Aggregate));
+                memcpy(virtualAggregates + i + 1, cursor->aggregates() + i, (NODE_KEYS - i) * sizeof(Aggregate));
+                virtualAggregates[i] = delta;
             }
-            // find position to insert new key
-            int i = 0, j;
-            while (key > virtualNode->keys[i] && i < NODE_KEYS) // i = index of first key larger than key
-                i++;
-            // make space for new key
-            for (int j = NODE_KEYS; j > i; j--)
-            {
-                virtualNode->keys[j] = virtualNode->keys[j - 1];
-                virtualNode->ptrs[j] = virtualNode->ptrs[j - 1];
-            }
-            virtualNode->keys[i] = key; // replace key
-            ptrs_struct newptr;
-            newptr.recordPtrs.push_back(recordAdd);
-            virtualNode->ptrs[i] = newptr; // replace recordaddress
 
-            newLeaf->isLeaf = true;
             cursor->size = (NODE_KEYS + 1) / 2;
             newLeaf->size = NODE_KEYS + 1 - (NODE_KEYS + 1) / 2; // splitting the node into 2 and deciding th sizes
-            newLeaf->ptrs[NODE_KEYS] = cursor->ptrs[NODE_KEYS];  // exhange pointers to next leaf
-            cursor->ptrs[NODE_KEYS].nodePtr = newLeaf;           // update pointer to next leaf node
-
-            // cursor->ptrs[NODE_KEYS].clear();                        // remove original link to next leaf
+            newLeaf->next = cursor->next;  // exhange pointers to next leaf
+            cursor->next = newLeaf->pageId;   // update pointer to next leaf node
 
-            for (i = 0; i < cursor->size; i++)
+            // transfering keys and ptrs into old node and new node
+            memcpy(cursor->keys(), virtualKey, cursor->size * sizeof(Key));
+            memcpy(cursor->records(), virtualRecords, cursor->size * sizeof(RecordsRef));
+            memcpy(newLeaf->keys(), virtualKey + cursor->size, newLeaf->size * sizeof(Key));
+            memcpy(newLeaf->records(), virtualRecords + cursor->size, newLeaf->size * sizeof(RecordsRef));
+            if (augmented)
             {
-                cursor->keys[i] = virtualNode->keys[i]; // transfering keys into old node insertion point 3
-                cursor->ptrs[i] = virtualNode->ptrs[i]; // transfering ptrs into old node insertion point 3
-            }
-            for (i = 0, j = cursor->size; i < newLeaf->size; i++, j++)
-            {
-                newLeaf->keys[i] = virtualNode->keys[j]; // transfering keys into new node insertion point 4
-                newLeaf->ptrs[i] = virtualNode->ptrs[j]; // transfering keys into new node insertion point 4
+                memcpy(cursor->aggregates(), virtualAggregates, cursor->size * sizeof(Aggregate));
+                memcpy(newLeaf->aggregates(), virtualAggregates + cursor->size, newLeaf->size * sizeof(Aggregate));
             }
 
             // if there is only cursor and newLeaf, just create a new root
-            if (cursor == root)
+            if (depth == 0)
             {
-                Node *newRoot = new Node(NODE_KEYS);
-                newRoot->keys[0] = newLeaf->keys[0];
-                newRoot->ptrs[0].nodePtr = cursor;
-                newRoot->ptrs[1].nodePtr = newLeaf;
-                newRoot->isLeaf = false;
+                Node *newRoot = createNode(false);
+                newRoot->keys()[0] = newLeaf->keys()[0];
+                newRoot->children()[0] = cursor->pageId;
+                newRoot->children()[1] = newLeaf->pageId;
+                setAggregate(newRoot, 0, getAggregate(cursor));
+                setAggregate(newRoot, 1, getAggregate(newLeaf));
                 newRoot->size = 1;
-                root = newRoot;
+                root = newRoot->pageId;
             }
-            else // there exist at least 2 levels, insert a new key into internal nodes
+            else // there exist at least 2 levels, insert a new key into the parent on the path
             {
-                insertInternal(newLeaf->keys[0], parent, newLeaf);
+                insertInternal(newLeaf->keys()[0], path, depth - 1, cursor, newLeaf);
             }
         }
     }
 }
 
 // Insert Operation
-void BPTree::insertInternal(int x, Node *cursor, Node *child)
+// inserts key x and the new node child into path[level].node, right after the child that was
+// split (left, which kept the first half)
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::insertInternal(Key x, PathEntry *path, int level, Node *left, Node *child)
 {
+    Node *cursor = path[level].node;
+    // the key goes right before the split child's new sibling
+    int i = path[level].childIndex;
     // there is still space in the parent node
     if (cursor->size < NODE_KEYS)
     {
-        int i = 0;
-        while (x > cursor->keys[i] && i < cursor->size)
-            i++;
-        for (int j = cursor->size; j > i; j--)
+        memmove(cursor->keys() + i + 1, cursor->keys() + i, (cursor->size - i) * sizeof(Key));
+        memmove(cursor->children() + i + 2, cursor->children() + i + 1, (cursor->size - i) * sizeof(PageId));
+        moveAggregates(cursor, i + 2, cursor, i + 1, cursor->size - i);
+        cursor->keys()[i] = x;
+        cursor->children()[i + 1] = child->pageId;
+        setAggregate(cursor, i, getAggregate(left));
+        setAggregate(cursor, i + 1, getAggregate(child));
+        cursor->size++;
+    }
+    // no more space in the parent node, need to split the parent node
+    else
+    {
+        Node *newInternal = createNode(false);
+        Key virtualKey[NODE_KEYS + 1];
+        PageId virtualPtr[NODE_KEYS + 2];
+        // copy the keys and ptrs, making space for x at i and for the pointer to child at i + 1
+        memcpy(virtualKey, cursor->keys(), i * sizeof(Key));
+        memcpy(virtualKey + i + 1, cursor->keys() + i, (NODE_KEYS - i) * sizeof(Key));
+        virtualKey[i] = x;
+        memcpy(virtualPtr, cursor->children(), (i + 1) * sizeof(PageId));
+        memcpy(virtualPtr + i + 2, cursor->children() + i + 1, (NODE_KEYS - i) * sizeof(PageId));
+        virtualPtr[i + 1] = child->pageId;
+        Aggregate virtualAggregates[NODE_KEYS + 2];
+        if (augmented)
         {
-            cursor->keys[j] = cursor->keys[j - 1];
+            memcpy(virtualAggregates, cursor->aggregates(), i * sizeof(Aggregate));
+            memcpy(virtualAggregates + i + 2, cursor->aggregates() + i + 1, (NODE_KEYS - i) * sizeof(Aggregate));
+            virtualAggregates[i] = getAggregate(left);
+            virtualAggregates[i + 1] = getAggregate(child);
         }
-        for (int j = cursor->size + 1; j > i + 1; j--)
+
+        cursor->size = (NODE_KEYS + 1) / 2;
+        newInternal->size = NODE_KEYS - (NODE_KEYS + 1) / 2;
+        // the middle key moves up to the parent
+        Key middleKey = virtualKey[cursor->size];
+
+        // assign key and ptrs of cursor
+        memcpy(cursor->keys(), virtualKey, cursor->size * sizeof(Key));
+        memcpy(cursor->children(), virtualPtr, (cursor->size + 1) * sizeof(PageId));
+        // assign keys and ptrs of newInternal
+        memcpy(newInternal->keys(), virtualKey + cursor->size + 1, newInternal->size * sizeof(Key));
+        memcpy(newInternal->children(), virtualPtr + cursor->size + 1, (newInternal->size + 1) * sizeof(PageId));
+        if (augmented)
         {
-            cursor->ptrs[j] = cursor->ptrs[j - 1];
+            memcpy(cursor->aggregates(), virtualAggregates, (cursor->size + 1) * sizeof(Aggregate));
+            memcpy(newInternal->aggregates(), virtualAggregates + cursor->size + 1, (newInternal->size + 1) * sizeof(Aggregate));
+        }
+
+        if (level == 0)
+        {
+            Node *newRoot = createNode(false);
+            newRoot->keys()[0] = middleKey;
+            newRoot->children()[0] = cursor->pageId;
+            newRoot->children()[1] = newInternal->pageId;
+            setAggregate(newRoot, 0, getAggregate(cursor));
+            setAggregate(newRoot, 1, getAggregate(newInternal));
+            newRoot->size = 1;
+            root = newRoot->pageId;
+        }
+        else // there are more than 2 levels in the current tree
+        {
+            insertInternal(middleKey, path, level - 1, cursor, newInternal);
         }
-        cursor->keys[i] = x;
-        cursor->ptrs[i + 1].nodePtr = child;
-        cursor->size++;
     }
-    // no more space in the parent node, need to split the parent node
-    else
+}
+
+// Batch insert operation
+// inserts entries in key order: descends once for each leaf the entries go to, merges all its
+// entries into the leaf in one pass and splits an overflowing leaf into as many leaves as
+// needed at once, the new nodes are added to the parents the same way
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::insertBatch(const vector<pair<Key, byte *>> &entries)
+{
+    if (entries.empty())
+    {
+        return;
+    }
+    // stable sort keeps the records of a key in the order they come in
+    vector<pair<Key, byte *>> sorted(entries);
+    stable_sort(sorted.begin(), sorted.end(), [](const pair<Key, byte *> &a, const pair<Key, byte *> &b)
+                { return keyLess(a.first, b.first); });
+
+    if (root == NO_PAGE)
     {
-        Node *newInternal = new Node(NODE_KEYS);
-        int virtualKey[NODE_KEYS + 1];
-        Node *virtualPtr[NODE_KEYS + 2];
-        for (int i = 0; i < NODE_KEYS; i++)
+        PinScope scope(this, true);
+        root = createNode(true)->pageId;
+    }
+    int noOfEntries = sorted.size();
+    for (int pos = 0; pos < noOfEntries;)
+    {
+        PinScope scope(this, true);
+        PathEntry path[MAX_TREE_HEIGHT];
+        int depth;
+        Node *leaf = findLeaf(sorted[pos].first, path, depth);
+
+        // the entries up to the separator after this leaf all go to it
+        int end = noOfEntries;
+        for (int level = depth - 1; level >= 0; level--)
         {
-            virtualKey[i] = cursor->keys[i];
+            if (path[level].childIndex < path[level].node->size)
+            {
+                Key bound = path[level].node->keys()[path[level].childIndex];
+                end = lower_bound(sorted.begin() + pos, sorted.end(), bound, [](const pair<Key, byte *> &entry, Key key)
+                                  { return keyLess(entry.first, key); }) - sorted.begin();
+                break;
+            }
         }
-        for (int i = 0; i < NODE_KEYS + 1; i++)
+
+        // merge the leaf with the entries, records of a key already in the leaf join it
+        vector<Key> keys;
+        vector<RecordsRef> records;
+        vector<Aggregate> aggregates;
+        Aggregate runTotal = {0, 0};
+        int i = 0;
+        while (i < leaf->size || pos < end)
         {
-            virtualPtr[i] = (Node *)cursor->ptrs[i].nodePtr;
+            if (pos == end || (i < leaf->size && !keyLess(sorted[pos].first, leaf->keys()[i])))
+            {
+                keys.push_back(leaf->keys()[i]);
+                records.push_back(leaf->records()[i]);
+                aggregates.push_back(augmented ? leaf->aggregates()[i] : Aggregate{0, 0});
+                i++;
+                continue;
+            }
+            RecordId recordId = storage->getRecordId(sorted[pos].second);
+            Aggregate delta = {1, augmented ? storage->viewRecord(sorted[pos].second).averageRating() : 0};
+            if (!keys.empty() && keyEqual(keys.back(), sorted[pos].first))
+            {
+                addRecord(records.back(), recordId);
+            }
+            else
+            {
+                keys.push_back(sorted[pos].first);
+                records.push_back(recordId);
+                aggregates.push_back({0, 0});
+            }
+            aggregates.back().count += delta.count;
+            aggregates.back().sum += delta.sum;
+            runTotal.count += delta.count;
+            runTotal.sum += delta.sum;
+            pos++;
         }
-        // find position to insert x
-        int i = 0, j;
-        while (x > virtualKey[i] && i < NODE_KEYS)
-            i++;
-        // make space for x
-        for (int j = NODE_KEYS; j > i; j--)
+        for (int level = 0; level < depth; level++)
         {
-            virtualKey[j] = virtualKey[j - 1];
+            addAggregate(path[level].node, path[level].childIndex, runTotal, 1);
         }
-        virtualKey[i] = x;
-        // make space for pointer to child
-        for (int j = NODE_KEYS + 1; j > i + 1; j--)
+
+        // spread the keys evenly over as few leaves as possible, the first one is this leaf
+        int count = keys.size();
+        int noOfNodes = (count + NODE_KEYS - 1) / NODE_KEYS;
+        vector<ChildEntry> newLeaves;
+        PageId next = leaf->next;
+        Node *prev = NULL;
+        for (int j = 0, k = 0; j < noOfNodes; j++)
+        {
+            Node *node = j == 0 ? leaf : createNode(true);
+            node->size = count / noOfNodes + (j < count % noOfNodes ? 1 : 0);
+            memcpy(node->keys(), keys.data() + k, node->size * sizeof(Key));
+            memcpy(node->records(), records.data() + k, node->size * sizeof(RecordsRef));
+            if (augmented)
+            {
+                memcpy(node->aggregates(), aggregates.data() + k, node->size * sizeof(Aggregate));
+            }
+            k += node->size;
+            if (prev != NULL)
+            {
+                prev->next = node->pageId;
+                if (prev != leaf)
+                {
+                    releaseNode(prev);
+                }
+            }
+            prev = node;
+            if (j > 0)
+            {
+                newLeaves.push_back({node->keys()[0], node->pageId, getAggregate(node)});
+            }
+        }
+        prev->next = next;
+        if (prev != leaf)
+        {
+            releaseNode(prev);
+        }
+
+        if (newLeaves.empty())
         {
-            virtualPtr[j] = virtualPtr[j - 1];
+            continue;
         }
-        virtualPtr[i + 1] = child;
+        if (depth == 0)
+        {
+            growRoot(leaf, newLeaves);
+        }
+        else
+        {
+            insertChildren(path, depth - 1, newLeaves);
+        }
+    }
+}
 
-        newInternal->isLeaf = false;
+// Batch insert operation
+// adds newChildren to path[level].node right after the child at path[level].childIndex, which
+// they were split off from, splitting the node into as many nodes as needed and going up the path
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::insertChildren(PathEntry *path, int level, const vector<ChildEntry> &newChildren)
+{
+    Node *cursor = path[level].node;
+    int i = path[level].childIndex;
 
-        cursor->size = (NODE_KEYS + 1) / 2;
-        newInternal->size = NODE_KEYS - (NODE_KEYS + 1) / 2;
+    // keys and children of the node with the new children inserted
+    vector<Key> keys(cursor->keys(), cursor->keys() + i);
+    vector<PageId> children(cursor->children(), cursor->children() + i + 1);
+    vector<Aggregate> aggregates;
+    if (augmented)
+    {
+        aggregates.assign(cursor->aggregates(), cursor->aggregates() + i);
+        // the child that was split lost entries to the new children
+        aggregates.push_back(getAggregate(getNode(cursor->children()[i])));
+    }
+    for (const ChildEntry &child : newChildren)
+    {
+        keys.push_back(child.key);
+        children.push_back(child.pageId);
+        aggregates.push_back(child.aggregate);
+    }
+    keys.insert(keys.end(), cursor->keys() + i, cursor->keys() + cursor->size);
+    children.insert(children.end(), cursor->children() + i + 1, cursor->children() + cursor->size + 1);
+    if (augmented)
+    {
+        aggregates.insert(aggregates.end(), cursor->aggregates() + i + 1, cursor->aggregates() + cursor->size + 1);
+    }
+
+    // spread the children evenly over as few nodes as possible, the first one is this node;
+    // the key in front of the first child of every other node moves up to the parent
+    int noOfChildren = children.size();
+    int noOfNodes = (noOfChildren + NODE_KEYS) / (NODE_KEYS + 1);
+    vector<ChildEntry> newNodes;
+    for (int j = 0, k = 0; j < noOfNodes; j++)
+    {
+        Node *node = j == 0 ? cursor : createNode(false);
+        int noOfPtrs = noOfChildren / noOfNodes + (j < noOfChildren % noOfNodes ? 1 : 0);
+        node->size = noOfPtrs - 1;
+        memcpy(node->children(), children.data() + k, noOfPtrs * sizeof(PageId));
+        memcpy(node->keys(), keys.data() + k, node->size * sizeof(Key));
+        if (augmented)
+        {
+            memcpy(node->aggregates(), aggregates.data() + k, noOfPtrs * sizeof(Aggregate));
+        }
+        if (j > 0)
+        {
+            newNodes.push_back({keys[k - 1], node->pageId, getAggregate(node)});
+            releaseNode(node);
+        }
+        k += noOfPtrs;
+    }
+
+    if (newNodes.empty())
+    {
+        return;
+    }
+    if (level == 0)
+    {
+        growRoot(cursor, newNodes);
+    }
+    else
+    {
+        insertChildren(path, level - 1, newNodes);
+    }
+}
+
+// put a new root above the root that was split, then add the nodes split off from it
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::growRoot(Node *oldRoot, const vector<ChildEntry> &newChildren)
+{
+    Node *newRoot = createNode(false);
+    newRoot->size = 0;
+    newRoot->children()[0] = oldRoot->pageId;
+    setAggregate(newRoot, 0, getAggregate(oldRoot));
+    root = newRoot->pageId;
+    PathEntry rootPath[1] = {{newRoot, 0}};
+    insertChildren(rootPath, 0, newChildren);
+}
+
+// Bulk load operation
+// builds the tree bottom-up from entries sorted by key: packs the leaves first, then
+// each internal level from the level below, in a single pass over the entries
+// fillFactor (0, 1] is the fraction of every node that is filled
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::bulkLoad(const vector<pair<Key, byte *>> &entries, float fillFactor)
+{
+    if (root != NO_PAGE)
+    {
+        throw std::logic_error("Bulk load requires an empty tree");
+    }
+    if (fillFactor <= 0 || fillFactor > 1)
+    {
+        throw std::invalid_argument("Fill factor must be in (0, 1]");
+    }
+    if (entries.empty())
+    {
+        return;
+    }
 
-        // assign key and ptrs of cursor
-        for (i = 0; i < cursor->size; i++)
+    // group duplicate keys, they share a single leaf entry
+    vector<Key> leafKeys;
+    vector<RecordsRef> leafRecords;
+    vector<Aggregate> leafAggregates;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (i > 0 && keyLess(entries[i].first, entries[i - 1].first))
         {
-            cursor->keys[i] = virtualKey[i];
+            throw std::invalid_argument("Bulk load entries must be sorted by key");
         }
-        for (i = 0; i < cursor->size + 1; i++)
+        if (i == 0 || !keyEqual(entries[i].first, entries[i - 1].first))
         {
-            cursor->ptrs[i].nodePtr = virtualPtr[i];
+            leafKeys.push_back(entries[i].first);
+            leafRecords.push_back(storage->getRecordId(entries[i].second));
+            leafAggregates.push_back({0, 0});
         }
-        // assign keys and ptrs of newInternal
-        for (i = 0, j = cursor->size + 1; i < newInternal->size; i++, j++)
+        else
         {
-            newInternal->keys[i] = virtualKey[j];
+            addRecord(leafRecords.back(), storage->getRecordId(entries[i].second));
         }
-        for (i = 0, j = cursor->size + 1; i < newInternal->size + 1; i++, j++)
+        if (augmented)
         {
-            newInternal->ptrs[i].nodePtr = virtualPtr[j];
+            leafAggregates.back().count++;
+            leafAggregates.back().sum += storage->viewRecord(entries[i].second).averageRating();
         }
+    }
+
+    // nodes of the level being built, together with the smallest key and the aggregate of
+    // their subtree (only the node being filled and the leaf before it stay pinned)
+    PinScope scope(this, true);
+    vector<PageId> level;
+    vector<Key> levelKeys;
+    vector<Aggregate> levelAggregates;
+    Node *prevLeaf = NULL;
 
-        if (cursor == root)
+    // leaf level, a leaf must keep at least (NODE_KEYS + 1) / 2 keys
+    int minKeys = (NODE_KEYS + 1) / 2;
+    int targetKeys = max(minKeys, min(NODE_KEYS, (int)(NODE_KEYS * fillFactor + 0.5)));
+    int n = leafKeys.size();
+    int noOfNodes = max(1, min((n + targetKeys - 1) / targetKeys, n / minKeys));
+    for (int i = 0, pos = 0; i < noOfNodes; i++)
+    {
+        // spread the keys evenly so that the last leaf is not underfull
+        Node *leaf = createNode(true);
+        leaf->size = n / noOfNodes + (i < n % noOfNodes ? 1 : 0);
+        for (int j = 0; j < leaf->size; j++, pos++)
         {
-            Node *newRoot = new Node(NODE_KEYS);
-            // newRoot->keys[0] = cursor->keys[cursor->size];
-            // get the smallest key found in the subtree under newInternal
-            newRoot->keys[0] = findSmallestKeyInSubtree(newInternal);
-            newRoot->ptrs[0].nodePtr = cursor;
-            newRoot->ptrs[1].nodePtr = newInternal;
-            newRoot->isLeaf = false;
-            newRoot->size = 1;
-            root = newRoot;
+            leaf->keys()[j] = leafKeys[pos];
+            leaf->records()[j] = leafRecords[pos];
+            setAggregate(leaf, j, leafAggregates[pos]);
         }
-        else // there are more than 2 levels in the current tree
+        // link to next leaf
+        if (prevLeaf != NULL)
         {
-            insertInternal(findSmallestKeyInSubtree(newInternal), findParent(root, cursor), newInternal);
+            prevLeaf->next = leaf->pageId;
+            releaseNode(prevLeaf);
         }
+        prevLeaf = leaf;
+        level.push_back(leaf->pageId);
+        levelKeys.push_back(leaf->keys()[0]);
+        levelAggregates.push_back(getAggregate(leaf));
     }
-}
-
-// find smallest key in subtree
-int BPTree::findSmallestKeyInSubtree(Node *cursor)
-{
-    int smallestKey;
-    while (!cursor->isLeaf)
-    {
-        cursor = (Node *)cursor->ptrs[0].nodePtr;
-    }
-    smallestKey = cursor->keys[0];
-    return smallestKey;
-}
+    releaseNode(prevLeaf);
 
-// Find the parent
-Node *BPTree::findParent(Node *cursor, Node *child)
-{
-    Node *parent;
-    // cursor cannot be a parent if it is a leaf node and parent of an internal node cannot be in the second last level
-    if (cursor->isLeaf || ((Node *)cursor->ptrs[0].nodePtr)->isLeaf)
-    {
-        return NULL;
-    }
-    // starting from root node, find the child node
-    for (int i = 0; i < cursor->size + 1; i++)
+    // internal levels, an internal node must keep at least NODE_KEYS / 2 keys
+    int minPtrs = NODE_KEYS / 2 + 1;
+    int targetPtrs = max(minPtrs, min(NODE_KEYS + 1, (int)((NODE_KEYS + 1) * fillFactor + 0.5)));
+    while (level.size() > 1)
     {
-        if ((Node *)cursor->ptrs[i].nodePtr == child)
+        vector<PageId> parents;
+        vector<Key> parentKeys;
+        vector<Aggregate> parentAggregates;
+        n = level.size();
+        noOfNodes = max(1, min((n + targetPtrs - 1) / targetPtrs, n / minPtrs));
+        for (int i = 0, pos = 0; i < noOfNodes; i++)
         {
-            parent = cursor;
-            return parent;
-        }
-        else
-        {
-            parent = findParent((Node *)cursor->ptrs[i].nodePtr, child);
-            if (parent != NULL)
-                return parent;
+            Node *internal = createNode(false);
+            int noOfPtrs = n / noOfNodes + (i < n % noOfNodes ? 1 : 0);
+            internal->size = noOfPtrs - 1;
+            parentKeys.push_back(levelKeys[pos]);
+            for (int j = 0; j < noOfPtrs; j++, pos++)
+            {
+                // key before each child (except the first) is the smallest key in its subtree
+                if (j > 0)
+                {
+                    internal->keys()[j - 1] = levelKeys[pos];
+                }
+                internal->children()[j] = level[pos];
+                setAggregate(internal, j, levelAggregates[pos]);
+            }
+            parents.push_back(internal->pageId);
+            parentAggregates.push_back(getAggregate(internal));
+            releaseNode(internal);
         }
+        level = parents;
+        levelKeys = parentKeys;
+        levelAggregates = parentAggregates;
     }
-    return parent;
+    root = level[0];
 }
 
 // Print the tree
-void BPTree::display(Node *cursor, int level)
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::display(Node *cursor, int level)
 {
     cout << "level: " << level << endl;
     if (cursor != NULL)
     {
+        PinScope scope(this, false);
+        cursor = getNode(cursor->pageId);
         for (int i = 0; i < cursor->size; i++)
         {
-            cout << cursor->keys[i] << " ";
+            cout << cursor->keys()[i] << " ";
         }
         cout << "\n";
         if (cursor->isLeaf != true)
         {
             for (int i = 0; i < cursor->size + 1; i++)
             {
-                display((Node *)cursor->ptrs[i].nodePtr, level + 1);
+                display(getNode(cursor->children()[i]), level + 1);
             }
         }
     }
 }
-void BPTree::remove(int key)
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::remove(Key key)
 {
     int mergeCount = 0;
-    if (this->root == NULL) {
+    PinScope scope(this, true);
+    if (this->root == NO_PAGE) {
         return;
     }
     
-    Node *cursor = root;
-    Node *parent;
-    int leftSibling, rightSibling;
-    //find leaf node which may contain key
-    while (!cursor->isLeaf)
+    //find leaf node which may contain key, remembering the path for the merges
+    PathEntry path[MAX_TREE_HEIGHT];
+    int depth;
+    Node *cursor = findLeaf(key, path, depth);
+    int pos = lowerBound(cursor->keys(), cursor->size, key);
+    if (pos == cursor->size || !keyEqual(cursor->keys()[pos], key))
     {
-        parent = cursor;
-        for (int i = 0; i < cursor->size; i++)
-        {
-            leftSibling = i - 1;
-            rightSibling = i + 1;
-            if (key < (cursor->keys)[i])
-            {
-                cursor = (Node *)cursor->ptrs[i].nodePtr;
-                break;
-            }
-            if (i == cursor->size - 1)
-            {
-                leftSibling = i;
-                rightSibling = i + 2;
-                cursor = (Node *)cursor->ptrs[i + 1].nodePtr;
-            }
-        }
+        return;
     }
-    bool found = false;
-    int pos;
-    for (pos = 0; pos < cursor->size; pos++)
+    //the records of the key leave the aggregates of every entry above it
+    if (augmented)
     {
-        if (cursor->keys[pos] == key)
+        for (int level = 0; level < depth; level++)
         {
-            found = true;
-            break;
+            addAggregate(path[level].node, path[level].childIndex, cursor->aggregates()[pos], -1);
         }
     }
-    if (!found)
-    {
-        return;
-    }
     //remove key & ptr to records
-    for (int i = pos; i < cursor->size - 1; i++)
-    {
-        cursor->keys[i] = cursor->keys[i + 1];
-        cursor->ptrs[i] = cursor->ptrs[i + 1];
-    }
+    releaseRecords(cursor->records()[pos]);
+    memmove(cursor->keys() + pos, cursor->keys() + pos + 1, (cursor->size - pos - 1) * sizeof(Key));
+    memmove(cursor->records() + pos, cursor->records() + pos + 1, (cursor->size - pos - 1) * sizeof(RecordsRef));
+    moveAggregates(cursor, pos, cursor, pos + 1, cursor->size - pos - 1);
     cursor->size--;
     //if only 1 level
-    if (cursor == root)
+    if (depth == 0)
     {
-        for (int i = 0; i < NODE_KEYS + 1; i++)
-        {
-            cursor->ptrs[i].nodePtr = NULL;
-        }
         //no more tree
         if (cursor->size == 0)
         {
             // cout << "Tree died\n";
-            delete[] cursor->keys;
-            delete[] cursor->ptrs;
-            delete cursor;
-            root = NULL;
+            destroyNode(cursor);
+            root = NO_PAGE;
         }
         return;
     }
-    //change parent key if i=0
-    if (leftSibling>=0 && pos==0){
-        parent->keys[leftSibling]=cursor->keys[0];
+    //change the separator of this leaf if its smallest key was removed
+    //(it is in the lowest ancestor where the path does not follow the first child)
+    if (pos == 0 && cursor->size > 0)
+    {
+        for (int level = depth - 1; level >= 0; level--)
+        {
+            if (path[level].childIndex > 0)
+            {
+                path[level].node->keys()[path[level].childIndex - 1] = cursor->keys()[0];
+                break;
+            }
+        }
     }
     //if current leaf node is of min size
     if (cursor->size >= (NODE_KEYS + 1) / 2)
@@ -701,43 +1379,48 @@ void BPTree::remove(int key)
     }
     //if current leaf node is not of min size
     //try borrowing from sibling nodes
+    Node *parent = path[depth - 1].node;
+    int leftSibling = path[depth - 1].childIndex - 1;
+    int rightSibling = path[depth - 1].childIndex + 1;
     //if left sibling exists
     if (leftSibling >= 0)
     {
-        Node *leftNode = (Node *)parent->ptrs[leftSibling].nodePtr;
+        Node *leftNode = getNode(parent->children()[leftSibling]);
         //borrow from left sibling if size will be big enough
         if (leftNode->size >= (NODE_KEYS + 1) / 2 + 1)
         {
-            for (int i = cursor->size; i > 0; i--)
-            {
-                cursor->keys[i] = cursor->keys[i - 1];
-                cursor->ptrs[i] = cursor->ptrs[i - 1];
-            }
+            memmove(cursor->keys() + 1, cursor->keys(), cursor->size * sizeof(Key));
+            memmove(cursor->records() + 1, cursor->records(), cursor->size * sizeof(RecordsRef));
+            moveAggregates(cursor, 1, cursor, 0, cursor->size);
             cursor->size++;
-            cursor->keys[0] = leftNode->keys[leftNode->size - 1];
-            cursor->ptrs[0] = leftNode->ptrs[leftNode->size - 1];
+            cursor->keys()[0] = leftNode->keys()[leftNode->size - 1];
+            cursor->records()[0] = leftNode->records()[leftNode->size - 1];
+            moveAggregates(cursor, 0, leftNode, leftNode->size - 1, 1);
             leftNode->size--;
-            parent->keys[leftSibling] = cursor->keys[0];
+            parent->keys()[leftSibling] = cursor->keys()[0];
+            setAggregate(parent, leftSibling, getAggregate(leftNode));
+            setAggregate(parent, leftSibling + 1, getAggregate(cursor));
             return;
         }
     }
     //if right sibling exists
     if (rightSibling <= parent->size)
     {
-        Node *rightNode = (Node *)parent->ptrs[rightSibling].nodePtr;
+        Node *rightNode = getNode(parent->children()[rightSibling]);
         //borrow from right sibling if size will be big enough
         if (rightNode->size >= (NODE_KEYS + 1) / 2 + 1)
         {
             cursor->size++;
-            cursor->keys[cursor->size - 1] = rightNode->keys[0];
-            cursor->ptrs[cursor->size - 1] = rightNode->ptrs[0];
+            cursor->keys()[cursor->size - 1] = rightNode->keys()[0];
+            cursor->records()[cursor->size - 1] = rightNode->records()[0];
+            moveAggregates(cursor, cursor->size - 1, rightNode, 0, 1);
             rightNode->size--;
-            for (int i = 0; i < rightNode->size; i++)
-            {
-                rightNode->keys[i] = rightNode->keys[i + 1];
-                rightNode->ptrs[i] = rightNode->ptrs[i + 1];
-            }
-            parent->keys[rightSibling - 1] = rightNode->keys[0];
+            memmove(rightNode->keys(), rightNode->keys() + 1, rightNode->size * sizeof(Key));
+            memmove(rightNode->records(), rightNode->records() + 1, rightNode->size * sizeof(RecordsRef));
+            moveAggregates(rightNode, 0, rightNode, 1, rightNode->size);
+            parent->keys()[rightSibling - 1] = rightNode->keys()[0];
+            setAggregate(parent, rightSibling - 1, getAggregate(cursor));
+            setAggregate(parent, rightSibling, getAggregate(rightNode));
             return;
         }
     }
@@ -746,149 +1429,657 @@ void BPTree::remove(int key)
     //if left sibling exists
     if (leftSibling >= 0)
     {
-        Node *leftNode = (Node *)parent->ptrs[leftSibling].nodePtr;
+        Node *leftNode = getNode(parent->children()[leftSibling]);
         //copy keys & ptrs from cursor to leftnode
-        for (int i = leftNode->size, j = 0; j < cursor->size; i++, j++)
+        memcpy(leftNode->keys() + leftNode->size, cursor->keys(), cursor->size * sizeof(Key));
+        memcpy(leftNode->records() + leftNode->size, cursor->records(), cursor->size * sizeof(RecordsRef));
+        moveAggregates(leftNode, leftNode->size, cursor, 0, cursor->size);
+        leftNode->size += cursor->size;
+        leftNode->next = cursor->next;
+        setAggregate(parent, leftSibling, getAggregate(leftNode));
+        destroyNode(cursor);
+        mergeCount++;
+        removeInternal(path, depth - 1, leftSibling, mergeCount);
+    }
+    //if right sibling exists
+    else if (rightSibling <= parent->size)
+    {
+        Node *rightNode = getNode(parent->children()[rightSibling]);
+        memcpy(cursor->keys() + cursor->size, rightNode->keys(), rightNode->size * sizeof(Key));
+        memcpy(cursor->records() + cursor->size, rightNode->records(), rightNode->size * sizeof(RecordsRef));
+        moveAggregates(cursor, cursor->size, rightNode, 0, rightNode->size);
+        cursor->size += rightNode->size;
+        cursor->next = rightNode->next;
+        setAggregate(parent, rightSibling - 1, getAggregate(cursor));
+        destroyNode(rightNode);
+        mergeCount += 1;
+        removeInternal(path, depth - 1, rightSibling - 1, mergeCount);
+    }
+
+    std::cout << "Merge Count: " << mergeCount << endl;
+}
+
+// removes the key at index x of path[level].node together with the child to its right,
+// which has been merged into its left sibling, then fixes an underflow of the node by
+// borrowing from or merging with a sibling on the path
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::removeInternal(PathEntry *path, int level, int x, int &mergeCount)
+{
+    Node *cursor = path[level].node;
+    memmove(cursor->keys() + x, cursor->keys() + x + 1, (cursor->size - x - 1) * sizeof(Key));
+    memmove(cursor->children() + x + 1, cursor->children() + x + 2, (cursor->size - x - 1) * sizeof(PageId));
+    moveAggregates(cursor, x + 1, cursor, x + 2, cursor->size - x - 1);
+    cursor->size--;
+
+    if (level == 0)
+    {
+        //root is left with a single child, the child becomes the root
+        if (cursor->size == 0)
         {
-            leftNode->keys[i] = cursor->keys[j];
-            leftNode->ptrs[i] = cursor->ptrs[j];
+            root = cursor->children()[0];
+            destroyNode(cursor);
         }
-        // leftNode->ptrs[leftNode->size].nodePtr = NULL;
-        leftNode->size += cursor->size;
-        if ((leftSibling+2)<=parent->size){
-            leftNode->ptrs[NODE_KEYS].nodePtr = parent->ptrs[leftSibling+2].nodePtr;
+        return;
+    }
+
+    //if cursor has enough number of keys
+    if (cursor->size >= NODE_KEYS / 2)
+    {
+        return;
+    }
+
+    Node *parent = path[level - 1].node;
+    int leftSibling = path[level - 1].childIndex - 1;
+    int rightSibling = path[level - 1].childIndex + 1;
+    //borrow from left sibling, rotating its last child through the parent key
+    if (leftSibling >= 0)
+    {
+        Node *leftNode = getNode(parent->children()[leftSibling]);
+        if (leftNode->size >= NODE_KEYS / 2 + 1)
+        {
+            memmove(cursor->keys() + 1, cursor->keys(), cursor->size * sizeof(Key));
+            memmove(cursor->children() + 1, cursor->children(), (cursor->size + 1) * sizeof(PageId));
+            moveAggregates(cursor, 1, cursor, 0, cursor->size + 1);
+            cursor->keys()[0] = parent->keys()[leftSibling];
+            cursor->children()[0] = leftNode->children()[leftNode->size];
+            moveAggregates(cursor, 0, leftNode, leftNode->size, 1);
+            cursor->size++;
+            parent->keys()[leftSibling] = leftNode->keys()[leftNode->size - 1];
+            leftNode->size--;
+            setAggregate(parent, leftSibling, getAggregate(leftNode));
+            setAggregate(parent, leftSibling + 1, getAggregate(cursor));
+            return;
         }
-        else{
-            leftNode->ptrs[NODE_KEYS].nodePtr=NULL;
+    }
+    //borrow from right sibling, rotating its first child through the parent key
+    if (rightSibling <= parent->size)
+    {
+        Node *rightNode = getNode(parent->children()[rightSibling]);
+        if (rightNode->size >= NODE_KEYS / 2 + 1)
+        {
+            cursor->keys()[cursor->size] = parent->keys()[rightSibling - 1];
+            cursor->children()[cursor->size + 1] = rightNode->children()[0];
+            moveAggregates(cursor, cursor->size + 1, rightNode, 0, 1);
+            cursor->size++;
+            parent->keys()[rightSibling - 1] = rightNode->keys()[0];
+            memmove(rightNode->keys(), rightNode->keys() + 1, (rightNode->size - 1) * sizeof(Key));
+            memmove(rightNode->children(), rightNode->children() + 1, rightNode->size * sizeof(PageId));
+            moveAggregates(rightNode, 0, rightNode, 1, rightNode->size);
+            rightNode->size--;
+            setAggregate(parent, rightSibling - 1, getAggregate(cursor));
+            setAggregate(parent, rightSibling, getAggregate(rightNode));
+            return;
         }
-        removeInternal(parent->keys[leftSibling], parent, cursor);
+    }
+    //merge with left sibling, pulling down the parent key between them
+    if (leftSibling >= 0)
+    {
+        Node *leftNode = getNode(parent->children()[leftSibling]);
+        leftNode->keys()[leftNode->size] = parent->keys()[leftSibling];
+        memcpy(leftNode->keys() + leftNode->size + 1, cursor->keys(), cursor->size * sizeof(Key));
+        memcpy(leftNode->children() + leftNode->size + 1, cursor->children(), (cursor->size + 1) * sizeof(PageId));
+        moveAggregates(leftNode, leftNode->size + 1, cursor, 0, cursor->size + 1);
+        leftNode->size += cursor->size + 1;
+        setAggregate(parent, leftSibling, getAggregate(leftNode));
+        destroyNode(cursor);
         mergeCount++;
-        delete[] cursor->keys;
-        delete[] cursor->ptrs;
-        delete cursor;
+        removeInternal(path, level - 1, leftSibling, mergeCount);
     }
-    //if right sibling exists
+    //merge with right sibling
     else if (rightSibling <= parent->size)
     {
-        Node *rightNode = (Node *)parent->ptrs[rightSibling].nodePtr;
-        for (int i = cursor->size, j = 0; j < rightNode->size; i++, j++)
+        Node *rightNode = getNode(parent->children()[rightSibling]);
+        cursor->keys()[cursor->size] = parent->keys()[rightSibling - 1];
+        memcpy(cursor->keys() + cursor->size + 1, rightNode->keys(), rightNode->size * sizeof(Key));
+        memcpy(cursor->children() + cursor->size + 1, rightNode->children(), (rightNode->size + 1) * sizeof(PageId));
+        moveAggregates(cursor, cursor->size + 1, rightNode, 0, rightNode->size + 1);
+        cursor->size += rightNode->size + 1;
+        setAggregate(parent, rightSibling - 1, getAggregate(cursor));
+        destroyNode(rightNode);
+        mergeCount++;
+        removeInternal(path, level - 1, rightSibling - 1, mergeCount);
+    }
+}
+// Range remove operation
+// removes every key in [startKey, endKey] and deletes its records from the storage, returns
+// the number of records deleted
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+int BPTree<Key, BlockSize, Compare, Augmented>::removeRange(Key startKey, Key endKey)
+{
+    if (keyLess(endKey, startKey))
+    {
+        return 0;
+    }
+    return removeRanges({{startKey, endKey}});
+}
+
+// Batch remove operation
+// removes the keys and deletes their records from the storage, returns the number of records
+// deleted
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+int BPTree<Key, BlockSize, Compare, Augmented>::removeBatch(const vector<Key> &keys)
+{
+    vector<Key> sortedKeys(keys);
+    sort(sortedKeys.begin(), sortedKeys.end(), keyLess);
+    sortedKeys.erase(unique(sortedKeys.begin(), sortedKeys.end(), keyEqual), sortedKeys.end());
+    vector<pair<Key, Key>> ranges;
+    for (Key key : sortedKeys)
+    {
+        ranges.push_back({key, key});
+    }
+    return removeRanges(ranges);
+}
+
+// removes the keys of the sorted ranges in three passes: the keys are taken out of the leaves
+// and the subtrees lying inside a range are dropped whole, without merging; then the nodes
+// left underfull, which are all on the paths to the ends of the ranges, are rebalanced; last
+// the records are deleted from the storage in block order
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+int BPTree<Key, BlockSize, Compare, Augmented>::removeRanges(const vector<pair<Key, Key>> &ranges)
+{
+    if (root == NO_PAGE || ranges.empty())
+    {
+        return 0;
+    }
+    // overlapping ranges are joined, so that every key belongs to a single range
+    vector<pair<Key, Key>> joined;
+    for (const pair<Key, Key> &range : ranges)
+    {
+        if (!joined.empty() && !keyLess(joined.back().second, range.first))
         {
-            cursor->keys[i] = rightNode->keys[j];
-            cursor->ptrs[i] = rightNode->ptrs[j];
+            joined.back().second = max(joined.back().second, range.second, keyLess);
         }
-        cursor->size += rightNode->size;
-        if ((rightSibling+1)<=parent->size){
-            cursor->ptrs[NODE_KEYS].nodePtr = parent->ptrs[rightSibling+1].nodePtr;
+        else
+        {
+            joined.push_back(range);
         }
-        else{
-            cursor->ptrs[NODE_KEYS].nodePtr=NULL;
+    }
+
+    vector<RecordId> recordIds;
+    // the leaf of the last key before a range is linked to the next leaf kept, as the leaves
+    // in between may be dropped
+    vector<Key> keysBefore;
+    for (const pair<Key, Key> &range : joined)
+    {
+        Key keyBefore;
+        if (findKeyBefore(range.first, keyBefore))
+        {
+            keysBefore.push_back(keyBefore);
+        }
+    }
+    {
+        PinScope scope(this, true);
+        removeRanges(getNode(root), NULL, NULL, joined, 0, joined.size(), recordIds);
+    }
+    //a dropped run of leaves follows the leaf of the key before its range, or the leaf kept at
+    //the start of the range
+    for (Key keyBefore : keysBefore)
+    {
+        relinkLeaf(keyBefore);
+    }
+    for (const pair<Key, Key> &range : joined)
+    {
+        if (root != NO_PAGE)
+        {
+            relinkLeaf(range.first);
+        }
+    }
+    for (const pair<Key, Key> &range : joined)
+    {
+        rebalancePath(range.first);
+        if (!keyEqual(range.second, range.first))
+        {
+            rebalancePath(range.second);
         }
-        mergeCount += 1;
-        removeInternal(parent->keys[rightSibling - 1], parent, rightNode);
-        delete[] rightNode->keys;
-        delete[] rightNode->ptrs;
-        delete rightNode;
     }
 
-    std::cout << "Merge Count: " << mergeCount << endl;
+    // record ids sort by block, then slot
+    sort(recordIds.begin(), recordIds.end());
+    vector<byte *> recordPtrs;
+    for (RecordId recordId : recordIds)
+    {
+        recordPtrs.push_back(storage->getRecordPtr(recordId));
+    }
+    storage->deleteRecords(recordPtrs);
+    return recordIds.size();
 }
-void BPTree::removeInternal(int x, Node *cursor, Node *child)
+
+// removes the keys of ranges[first, last) from the subtree of node, whose keys are in
+// [*lower, *upper) (NULL for no bound), collecting their records in recordIds; nodes may be
+// left underfull, even empty
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::removeRanges(Node *node, const Key *lower, const Key *upper, const vector<pair<Key, Key>> &ranges, int first, int last, vector<RecordId> &recordIds)
 {
-    if (cursor == root)
+    if (node->isLeaf)
     {
-        if (cursor->size == 1)
+        int size = 0;
+        for (int i = 0, j = first; i < node->size; i++)
         {
-            if (cursor->ptrs[1].nodePtr == child)
+            while (j < last && keyLess(ranges[j].second, node->keys()[i]))
             {
-                delete[] child->keys;
-                delete[] child->ptrs;
-                delete child;
-                root = (Node *)cursor->ptrs[0].nodePtr;
-                delete[] cursor->keys;
-                delete[] cursor->ptrs;
-                delete cursor;
-                return;
+                j++;
             }
-            else if (cursor->ptrs[0].nodePtr == child)
+            if (j < last && !keyLess(node->keys()[i], ranges[j].first))
             {
-                delete[] child->keys;
-                delete[] child->ptrs;
-                delete child;
-                root = (Node *)(cursor->ptrs)[1].nodePtr;
-                delete[] cursor->keys;
-                delete[] cursor->ptrs;
-                delete cursor;
-                return;
+                takeRecords(node->records()[i], recordIds);
+                continue;
             }
+            node->keys()[size] = node->keys()[i];
+            node->records()[size] = node->records()[i];
+            moveAggregates(node, size, node, i, 1);
+            size++;
         }
+        node->size = size;
+        return;
     }
 
-    //if cursor has enough number of keys
-    if (cursor->size>(NODE_KEYS/2)){
-        //find position of x
-        int i = 0;
-        while (x > cursor->keys[i] && i < cursor->size)
-            i++;
+    // the children lying inside a range are dropped whole, the other children with keys of
+    // a range (those with an end of the range) lose these keys
+    vector<bool> dropped(node->size + 1, false);
+    vector<int> touched;
+    vector<pair<int, int>> touchedRanges;
+    for (int j = first; j < last; j++)
+    {
+        int from = upperBound(node->keys(), node->size, ranges[j].first);
+        int to = upperBound(node->keys(), node->size, ranges[j].second);
+        for (int i = from; i <= to; i++)
+        {
+            // a child whose upper bound is in the range surely lies inside it
+            const Key *childLower = i == 0 ? lower : node->keys() + i - 1;
+            const Key *childUpper = i == node->size ? upper : node->keys() + i;
+            if (childLower != NULL && !keyLess(*childLower, ranges[j].first) &&
+                childUpper != NULL && !keyLess(ranges[j].second, *childUpper))
+            {
+                dropped[i] = true;
+            }
+            else if (!touched.empty() && touched.back() == i)
+            {
+                touchedRanges.back().second = j + 1;
+            }
+            else
+            {
+                touched.push_back(i);
+                touchedRanges.push_back({j, j + 1});
+            }
+        }
+    }
+    for (size_t k = 0; k < touched.size(); k++)
+    {
+        PinScope scope(this, true);
+        int i = touched[k];
+        Node *child = getNode(node->children()[i]);
+        removeRanges(child, i == 0 ? lower : node->keys() + i - 1, i == node->size ? upper : node->keys() + i,
+                     ranges, touchedRanges[k].first, touchedRanges[k].second, recordIds);
+        setAggregate(node, i, getAggregate(child));
+    }
+
+    // a kept child keeps the key right before it, which separates it from the kept child
+    // before it (a node never has all of its children dropped, it would lie inside a range)
+    int noOfPtrs = 0;
+    for (int i = 0; i <= node->size; i++)
+    {
+        if (dropped[i])
+        {
+            destroySubtree(node->children()[i], recordIds);
+            continue;
+        }
+        if (noOfPtrs > 0)
+        {
+            node->keys()[noOfPtrs - 1] = node->keys()[i - 1];
+        }
+        node->children()[noOfPtrs] = node->children()[i];
+        moveAggregates(node, noOfPtrs, node, i, 1);
+        noOfPtrs++;
+    }
+    node->size = noOfPtrs - 1;
+}
+
+// the greatest key in the tree below key, false if there is none
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+bool BPTree<Key, BlockSize, Compare, Augmented>::findKeyBefore(Key key, Key &keyBefore)
+{
+    PinScope scope(this, false);
+    PathEntry path[MAX_TREE_HEIGHT];
+    int depth;
+    Node *cursor = findLeaf(key, path, depth);
+    int pos = lowerBound(cursor->keys(), cursor->size, key);
+    if (pos == 0)
+    {
+        //last key of the leaf before, under the lowest ancestor where the path does not
+        //follow the first child
+        int level = depth - 1;
+        while (level >= 0 && path[level].childIndex == 0)
+        {
+            level--;
+        }
+        if (level < 0)
+        {
+            return false;
+        }
+        cursor = getNode(path[level].node->children()[path[level].childIndex - 1]);
+        while (!cursor->isLeaf)
+        {
+            cursor = getNode(cursor->children()[cursor->size]);
+        }
+        pos = cursor->size;
+    }
+    keyBefore = cursor->keys()[pos - 1];
+    return true;
+}
+
+// link the leaf holding key to the leaf after it in the tree, once the leaves between them
+// were dropped
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::relinkLeaf(Key key)
+{
+    PinScope scope(this, true);
+    PathEntry path[MAX_TREE_HEIGHT];
+    int depth;
+    Node *leaf = findLeaf(key, path, depth);
+    //first leaf under the lowest ancestor where the path does not follow the last child
+    int level = depth - 1;
+    while (level >= 0 && path[level].childIndex == path[level].node->size)
+    {
+        level--;
+    }
+    if (level < 0)
+    {
+        leaf->next = NO_PAGE;
+        return;
+    }
+    Node *cursor = getNode(path[level].node->children()[path[level].childIndex + 1]);
+    while (!cursor->isLeaf)
+    {
+        cursor = getNode(cursor->children()[0]);
+    }
+    leaf->next = cursor->pageId;
+}
+
+// collect the records of a removed key and free its posting pages
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::takeRecords(RecordsRef records, vector<RecordId> &recordIds)
+{
+    if (records & POSTING_FLAG)
+    {
+        postings.getRecords(records & ~POSTING_FLAG, recordIds);
+    }
+    else
+    {
+        recordIds.push_back(records);
+    }
+    releaseRecords(records);
+}
+
+// free the nodes of a subtree, collecting the records of its keys
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::destroySubtree(PageId pageId, vector<RecordId> &recordIds)
+{
+    PinScope scope(this, true);
+    Node *node = getNode(pageId);
+    if (node->isLeaf)
+    {
+        for (int i = 0; i < node->size; i++)
+        {
+            takeRecords(node->records()[i], recordIds);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < node->size + 1; i++)
+        {
+            destroySubtree(node->children()[i], recordIds);
+        }
+    }
+    destroyNode(node);
+}
+
+// rebalance the underfull nodes on the path to key, lowest first, each with a sibling; a
+// merge may leave the parent underfull, which is then rebalanced in turn
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::rebalancePath(Key key)
+{
+    while (true)
+    {
+        PinScope scope(this, true);
+        if (root == NO_PAGE)
+        {
+            return;
+        }
+        //a root with a single child gives way to it, an empty root leaf leaves no tree
+        Node *rootNode = getNode(root);
+        if (rootNode->size == 0)
+        {
+            root = rootNode->isLeaf ? NO_PAGE : rootNode->children()[0];
+            destroyNode(rootNode);
+            continue;
+        }
+
+        PathEntry path[MAX_TREE_HEIGHT];
+        int depth;
+        Node *cursor = findLeaf(key, path, depth);
+        int minKeys = (NODE_KEYS + 1) / 2;
+        int level = depth;
+        //an underfull node whose parent has a single child waits for the parent to get siblings
+        while (level > 0 && (cursor->size >= minKeys || path[level - 1].node->size == 0))
+        {
+            level--;
+            cursor = path[level].node;
+            minKeys = NODE_KEYS / 2;
+        }
+        if (level == 0)
+        {
+            return;
+        }
+        Node *parent = path[level - 1].node;
+        int i = path[level - 1].childIndex;
+        rebalanceChildren(parent, i < parent->size ? i : i - 1);
+    }
+}
 
-        for (int j = i; j < (cursor->size-1); j++)
+// merge the children left and left + 1 of parent if they fit in a node, otherwise even out
+// their keys
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::rebalanceChildren(Node *parent, int left)
+{
+    Node *leftNode = getNode(parent->children()[left]);
+    Node *rightNode = getNode(parent->children()[left + 1]);
+    Aggregate total = {getAggregate(leftNode).count + getAggregate(rightNode).count,
+                       getAggregate(leftNode).sum + getAggregate(rightNode).sum};
+    bool merge;
+    if (leftNode->isLeaf)
+    {
+        int size = leftNode->size + rightNode->size;
+        merge = size <= NODE_KEYS;
+        int leftSize = merge ? size : size / 2;
+        if (leftSize >= leftNode->size)
         {
-            cursor->keys[j] = cursor->keys[j + 1];
+            //move the first keys of the right node to the end of the left node
+            int count = leftSize - leftNode->size;
+            memcpy(leftNode->keys() + leftNode->size, rightNode->keys(), count * sizeof(Key));
+            memcpy(leftNode->records() + leftNode->size, rightNode->records(), count * sizeof(RecordsRef));
+            moveAggregates(leftNode, leftNode->size, rightNode, 0, count);
+            memmove(rightNode->keys(), rightNode->keys() + count, (rightNode->size - count) * sizeof(Key));
+            memmove(rightNode->records(), rightNode->records() + count, (rightNode->size - count) * sizeof(RecordsRef));
+            moveAggregates(rightNode, 0, rightNode, count, rightNode->size - count);
+            rightNode->size -= count;
         }
-        for (int j = i; j < (cursor->size-1); j++)
+        else
+        {
+            //move the last keys of the left node to the front of the right node
+            int count = leftNode->size - leftSize;
+            memmove(rightNode->keys() + count, rightNode->keys(), rightNode->size * sizeof(Key));
+            memmove(rightNode->records() + count, rightNode->records(), rightNode->size * sizeof(RecordsRef));
+            moveAggregates(rightNode, count, rightNode, 0, rightNode->size);
+            memcpy(rightNode->keys(), leftNode->keys() + leftSize, count * sizeof(Key));
+            memcpy(rightNode->records(), leftNode->records() + leftSize, count * sizeof(RecordsRef));
+            moveAggregates(rightNode, 0, leftNode, leftSize, count);
+            rightNode->size += count;
+        }
+        leftNode->size = leftSize;
+        if (merge)
+        {
+            leftNode->next = rightNode->next;
+        }
+        else
+        {
+            parent->keys()[left] = rightNode->keys()[0];
+        }
+    }
+    else
+    {
+        //the parent key between the two nodes comes down between their children
+        vector<Key> keys(leftNode->keys(), leftNode->keys() + leftNode->size);
+        keys.push_back(parent->keys()[left]);
+        keys.insert(keys.end(), rightNode->keys(), rightNode->keys() + rightNode->size);
+        vector<PageId> children(leftNode->children(), leftNode->children() + leftNode->size + 1);
+        children.insert(children.end(), rightNode->children(), rightNode->children() + rightNode->size + 1);
+        vector<Aggregate> aggregates;
+        if (augmented)
+        {
+            aggregates.assign(leftNode->aggregates(), leftNode->aggregates() + leftNode->size + 1);
+            aggregates.insert(aggregates.end(), rightNode->aggregates(), rightNode->aggregates() + rightNode->size + 1);
+        }
+        int noOfChildren = children.size();
+        merge = noOfChildren <= NODE_KEYS + 1;
+        int leftPtrs = merge ? noOfChildren : noOfChildren / 2;
+        leftNode->size = leftPtrs - 1;
+        memcpy(leftNode->keys(), keys.data(), leftNode->size * sizeof(Key));
+        memcpy(leftNode->children(), children.data(), leftPtrs * sizeof(PageId));
+        if (augmented)
+        {
+            memcpy(leftNode->aggregates(), aggregates.data(), leftPtrs * sizeof(Aggregate));
+        }
+        if (!merge)
         {
-            cursor->ptrs[j] = cursor->ptrs[j + 1];
+            //the key in front of the first child of the right node goes up to the parent
+            parent->keys()[left] = keys[leftPtrs - 1];
+            rightNode->size = noOfChildren - leftPtrs - 1;
+            memcpy(rightNode->keys(), keys.data() + leftPtrs, rightNode->size * sizeof(Key));
+            memcpy(rightNode->children(), children.data() + leftPtrs, (noOfChildren - leftPtrs) * sizeof(PageId));
+            if (augmented)
+            {
+                memcpy(rightNode->aggregates(), aggregates.data() + leftPtrs, (noOfChildren - leftPtrs) * sizeof(Aggregate));
+            }
         }
-        cursor->size--;
+    }
+
+    if (merge)
+    {
+        //the right node goes with the parent key in front of it
+        memmove(parent->keys() + left, parent->keys() + left + 1, (parent->size - left - 1) * sizeof(Key));
+        memmove(parent->children() + left + 1, parent->children() + left + 2, (parent->size - left - 1) * sizeof(PageId));
+        moveAggregates(parent, left + 1, parent, left + 2, parent->size - left - 1);
+        parent->size--;
+        setAggregate(parent, left, total);
+        destroyNode(rightNode);
+    }
+    else
+    {
+        setAggregate(parent, left, getAggregate(leftNode));
+        setAggregate(parent, left + 1, getAggregate(rightNode));
     }
 }
+
 // Get the root
-Node *BPTree::getRoot()
+// the root is not pinned, the pointer is only valid until the tree is accessed again
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+auto BPTree<Key, BlockSize, Compare, Augmented>::getRoot() -> Node *
 {
-    return root;
+    if (root == NO_PAGE)
+    {
+        return NULL;
+    }
+    return (Node *)pages.getPage(root);
 }
 
 //Get NODE_KEYS
-int BPTree::getNodeKeys(){
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+int BPTree<Key, BlockSize, Compare, Augmented>::getNodeKeys(){
     return NODE_KEYS;
 }
 
+//Whether nodes keep aggregates
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+bool BPTree<Key, BlockSize, Compare, Augmented>::isAugmented(){
+    return augmented;
+}
+
+//Get number of posting pages in use
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+int BPTree<Key, BlockSize, Compare, Augmented>::getNoOfPostingPages(){
+    return postings.getUsedPages();
+}
+
 // Get number of nodes
-void BPTree::getNoOfNodes(Node *cursor, int *size)
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::getNoOfNodes(Node *cursor, int *size)
 {
     if (cursor != NULL)
     {
+        PinScope scope(this, false);
+        cursor = getNode(cursor->pageId);
         (*size)++;
         if (cursor->isLeaf != true)
         {
             for (int i = 0; i < cursor->size + 1; i++)
             {
-                getNoOfNodes((Node *)cursor->ptrs[i].nodePtr, size);
+                getNoOfNodes(getNode(cursor->children()[i]), size);
             }
         }
     }
 }
 
 // get height
-int BPTree::getHeight(Node *cursor) {
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+int BPTree<Key, BlockSize, Compare, Augmented>::getHeight(Node *cursor) {
     if (cursor == NULL) {
         return -1;
     }
-    return this->getHeight((Node *)cursor->ptrs[0].nodePtr) + 1;
+    if (cursor->isLeaf) {
+        return 0;
+    }
+    PinScope scope(this, false);
+    return this->getHeight(this->getNode(cursor->children()[0])) + 1;
 }
 
 //get root contents
-void BPTree::getRootContents(){
-    for (int i=0;i<(root->size);i++){
-        cout << root->keys[i]<<", ";
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::getRootContents(){
+    PinScope scope(this, false);
+    Node *rootNode=getNode(root);
+    for (int i=0;i<(rootNode->size);i++){
+        cout << rootNode->keys()[i]<<", ";
     }
     cout <<"\n";
 }
 
 //get first child node contents
-void BPTree::getRootChildContents(){
-    Node *firstChild=(Node *)(root->ptrs[0].nodePtr);
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
+void BPTree<Key, BlockSize, Compare, Augmented>::getRootChildContents(){
+    PinScope scope(this, false);
+    Node *firstChild=getNode(getNode(root)->children()[0]);
     for (int i=0;i<(firstChild->size);i++){
-        cout << firstChild->keys[i]<<", ";
+        cout << firstChild->keys()[i]<<", ";
     }
     cout <<"\n";
 }
\ No newline at end of file
@@ -1,54 +1,252 @@
 #pragma once
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include "pagefile.h"
+#include "postings.h"
+#include "storage.h"
 using namespace std;
 // const int NODE_KEYS = 3;
 
-struct ptrs_struct
+// Records of a key in a leaf: a key with a single record holds its record id,
+// duplicate keys keep their records in a posting list and hold the id of its first page,
+// tagged with POSTING_FLAG
+typedef uint64_t RecordsRef;
+const RecordsRef POSTING_FLAG = (RecordsRef)1 << (sizeof(RecordsRef) * 8 - 1);
+
+// Number of records and sum of their averageRating, kept for each key of a leaf and for the
+// subtree of each child of an internal node in an augmented tree
+struct Aggregate
 {
-    void *nodePtr = NULL;
-    vector<byte *> recordPtrs;
+    long long count;
+    double sum;
 };
 
+template <typename Key, int BlockSize, typename Compare = std::less<Key>, bool Augmented = false>
+class BPTree;
+
+// Bytes of the node header
+const int NODE_HEADER_SIZE = 16;
+
+// A node is a single page of the page file of its tree, starting with a NODE_HEADER_SIZE-byte
+// header. The header is followed by Capacity keys, then by
+// - internal node: size + 1 page ids of the child nodes
+// - leaf node: the records of each key (the next leaf is kept in the header)
+// and, in an augmented tree, by the aggregate of each key (leaf) or child (internal node).
+// Capacity is a compile-time constant of the tree, so are the offsets of these arrays.
+template <typename Key, int Capacity>
 class Node
 {
 
+    template <typename, int, typename, bool>
     friend class BPTree;
 
 private:
     int size;
-    int *keys;
-    ptrs_struct *ptrs;
+    short capacity;
     bool isLeaf;
+    PageId pageId;
+    PageId next;
 
-public:
-    Node();
-    Node(int i);
-    ~Node();
+    Node(bool isLeaf, PageId pageId);
+    Key *keys();
+    PageId *children();
+    RecordsRef *records();
+    Aggregate *aggregates();
 };
 
+// Trees never get higher than this, even with 2 children per node on 2^31 keys
+const int MAX_TREE_HEIGHT = 32;
+
+// The meta page of a tree is the first page allocated in its page file
+const PageId META_PAGE = 1;
+
+// Contents of the meta page
+struct TreeMeta
+{
+    int nodeKeys;
+    PageId root;
+    int noOfPostingPages;
+    int augmented;
+    int keySize;
+};
+
+// Smallest buffer pool of a tree in a page file, enough for all nodes an insert or a remove
+// keeps pinned at once in the highest tree
+const int MIN_BUFFER_FRAMES = 4 * MAX_TREE_HEIGHT;
+
+// Number of index blocks whose keys a search reports
+const int REPORTED_INDEX_BLOCKS = 5;
+
+// B+ tree indexing the records of a storage by a key of type Key, in the order of Compare.
+// Every node is a page of BlockSize bytes, which must be the block size of the storage; the
+// number of keys per node follows from the size of Key at compile time, so every tree type gets
+// its own in-node loops and searches. An Augmented tree also keeps the number and rating sum of
+// the records below each entry.
+// Keys are copied with memcpy and must be trivially copyable.
+template <typename Key, int BlockSize, typename Compare, bool Augmented>
 class BPTree
 {
+public:
+    // Keys per node: after the header, the padding of the keys to record alignment and the
+    // extra record reference (and aggregate) of the NODE_KEYS + 1 children, each key takes its
+    // own bytes and a record reference (and an aggregate when augmented), which gives
+    // n = (BLOCK_SIZE - 32) / 12 for int keys
+    static constexpr int NODE_KEYS = (BlockSize - NODE_HEADER_SIZE - 2 * (int)sizeof(RecordsRef) - (Augmented ? (int)sizeof(Aggregate) : 0)) /
+                                     (int)(sizeof(Key) + sizeof(RecordsRef) + (Augmented ? sizeof(Aggregate) : 0));
+    static constexpr int BLOCK_SIZE = BlockSize;
+
+    typedef ::Node<Key, NODE_KEYS> Node;
+
+    // Forward cursor over the records of a key range [startKey, endKey], created by seek.
+    // Records come one at a time in key order: the cursor keeps only the current leaf pinned
+    // and reads the next leaf of the chain or the next posting page only when it gets there,
+    // so a scan can stop early and never holds more than a page of the range. A cursor must
+    // not outlive its tree, and is invalidated by any change to the tree.
+    class RangeCursor
+    {
+
+        friend class BPTree;
+
+    private:
+        BPTree *tree;
+        Key endKey;
+        // current leaf, pinned by the cursor, NULL after the end of the range
+        Node *leaf;
+        // index of the next key in the leaf
+        int keyIndex;
+        // page of the posting list being read and index of its next record, NO_PAGE if none
+        PageId postingPage;
+        int postingIndex;
+        // nodes and posting pages read so far, keys of the first nodes read
+        int noOfIndexBlocks;
+        int noOfPostingPages;
+        vector<vector<Key>> indexContents;
+        // buffer pool counters when the cursor was created
+        long hits;
+        long reads;
+
+        RangeCursor(BPTree *tree, Key endKey);
+        void visit(Node *node);
+        void moveTo(Node *node);
+
+    public:
+        RangeCursor(RangeCursor &&other);
+        RangeCursor(const RangeCursor &) = delete;
+        RangeCursor &operator=(const RangeCursor &) = delete;
+        ~RangeCursor();
+        byte *next();
+        void printAccessStats();
+    };
+
 private:
-    Node *root;
-    int NODE_KEYS;
-    Node *search(int key);
-    void insertInternal(int, Node *, Node *);
-    int findSmallestKeyInSubtree(Node *);
-    Node *findParent(Node *, Node *);
-    void removeInternal(int, Node *, Node *);
+    static_assert(std::is_trivially_copyable<Key>::value, "B+ tree keys are copied with memcpy");
+    static_assert(sizeof(Node) == NODE_HEADER_SIZE, "Node header does not match the page layout");
+    static_assert(NODE_KEYS >= 2, "Block size too small for a B+ tree node");
+    // header, keys (plus padding to record alignment), NODE_KEYS + 1 records and the
+    // aggregates of an augmented tree must fit in a block
+    static_assert(NODE_HEADER_SIZE + NODE_KEYS * sizeof(Key) + sizeof(RecordsRef) + (NODE_KEYS + 1) * sizeof(RecordsRef) + (Augmented ? (NODE_KEYS + 1) * sizeof(Aggregate) : 0) <= BlockSize,
+                  "Block size too small for a B+ tree node");
+
+    // nodes keep the aggregates of their keys or children
+    static constexpr bool augmented = Augmented;
+
+    // One level of a root-to-leaf descent: the internal node and the index of the child followed
+    struct PathEntry
+    {
+        Node *node;
+        int childIndex;
+    };
+
+    // A node to add to an internal node: the smallest key in its subtree, its page and the
+    // aggregate of its subtree
+    struct ChildEntry
+    {
+        Key key;
+        PageId pageId;
+        Aggregate aggregate;
+    };
+
+    // Unpins the nodes pinned during a tree operation when the operation ends,
+    // marking them dirty if the operation changes the tree
+    class PinScope
+    {
+    private:
+        BPTree *tree;
+        size_t firstPin;
+        bool wasWriting;
+
+    public:
+        PinScope(BPTree *tree, bool writing);
+        ~PinScope();
+    };
+
+    PageId root;
+    Storage *storage;
+    PageFile pages;
+    PostingPool postings;
+    // pages pinned by getNode in the running operations, in pinning order
+    vector<PageId> pinnedPages;
+    // the running operation changes the tree
+    bool writing;
+    static bool keyLess(const Key &a, const Key &b);
+    static bool keyEqual(const Key &a, const Key &b);
+    static int searchNodeKeys(const Key *keys, int size, Key key, bool orEqual);
+    static int lowerBound(const Key *keys, int size, Key key);
+    static int upperBound(const Key *keys, int size, Key key);
+    void init();
+    void writeMeta();
+    Node *getNode(PageId pageId);
+    void releaseNode(Node *node);
+    Node *nextLeaf(Node *leaf);
+    Node *createNode(bool isLeaf);
+    void destroyNode(Node *);
+    void addRecord(RecordsRef &records, RecordId recordId);
+    int getRecords(RecordsRef records, vector<byte *> &recordList);
+    void releaseRecords(RecordsRef records);
+    Aggregate getAggregate(Node *node);
+    void setAggregate(Node *node, int index, Aggregate aggregate);
+    void addAggregate(Node *node, int index, Aggregate delta, int sign);
+    void moveAggregates(Node *to, int toIndex, Node *from, int fromIndex, int count);
+    Aggregate prefixAggregate(Key key, bool orEqual);
+    Node *findLeaf(Key key, PathEntry *path, int &depth);
+    void insertInternal(Key, PathEntry *, int, Node *, Node *);
+    void insertChildren(PathEntry *path, int level, const vector<ChildEntry> &newChildren);
+    void growRoot(Node *oldRoot, const vector<ChildEntry> &newChildren);
+    void removeInternal(PathEntry *, int, int, int &);
+    int removeRanges(const vector<pair<Key, Key>> &ranges);
+    void removeRanges(Node *node, const Key *lower, const Key *upper, const vector<pair<Key, Key>> &ranges, int first, int last, vector<RecordId> &recordIds);
+    bool findKeyBefore(Key key, Key &keyBefore);
+    void relinkLeaf(Key key);
+    void takeRecords(RecordsRef records, vector<RecordId> &recordIds);
+    void destroySubtree(PageId pageId, vector<RecordId> &recordIds);
+    void rebalancePath(Key key);
+    void rebalanceChildren(Node *parent, int left);
+    void printAccessStats(int noOfIndexBlocks, int noOfPostingPages, const vector<vector<Key>> &indexContents, long hits, long reads);
 
 public:
-    BPTree(int);
+    BPTree(Storage &storage);
+    BPTree(Storage &storage, const char *path, int noOfFrames);
     ~BPTree();
-    void insert(int key, byte *recordPtr);
-    vector<byte *> searchRecords(int key);
-    vector<byte *> searchRange(int startKey, int endKey);
-    void remove(int x);
+    void sync();
+    void insert(Key key, byte *recordPtr);
+    void bulkLoad(const vector<pair<Key, byte *>> &entries, float fillFactor);
+    void insertBatch(const vector<pair<Key, byte *>> &entries);
+    vector<byte *> searchRecords(Key key);
+    vector<byte *> searchRange(Key startKey, Key endKey);
+    RangeCursor seek(Key startKey, Key endKey);
+    Aggregate aggregateRange(Key startKey, Key endKey);
+    void remove(Key x);
+    int removeRange(Key startKey, Key endKey);
+    int removeBatch(const vector<Key> &keys);
     void display(Node *, int);
     Node *getRoot();
     int getNodeKeys();
+    bool isAugmented();
+    int getNoOfPostingPages();
     void getNoOfNodes(Node *, int *);
     int getHeight(Node *);
     void getRootContents();
     void getRootChildContents();
     void cleanUp(Node *);
-};
\ No newline at end of file
+};
@@ -0,0 +1,417 @@
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include "concurrentbptree.h"
+using namespace std;
+
+// entries of the same key are ordered by record pointer
+static bool entryLess(const IndexEntry &a, const IndexEntry &b)
+{
+    return a.key < b.key || (a.key == b.key && less<byte *>()(a.recordPtr, b.recordPtr));
+}
+
+// index of the first of the size entries that is not less than entry
+// size is clamped, an optimistic reader may see any size before it validates the node
+static int lowerBound(const IndexEntry *entries, int size, IndexEntry entry)
+{
+    size = max(0, min(size, CONCURRENT_NODE_KEYS));
+    return lower_bound(entries, entries + size, entry, entryLess) - entries;
+}
+
+// index of the child of an internal node whose subtree may hold entry
+static int childIndex(const IndexEntry *keys, int size, IndexEntry entry)
+{
+    size = max(0, min(size, CONCURRENT_NODE_KEYS));
+    return upper_bound(keys, keys + size, entry, entryLess) - keys;
+}
+
+VersionLock::VersionLock() : version(0)
+{
+}
+
+// wait until the node is unlocked, returns the version to validate the read against
+uint64_t VersionLock::readLock()
+{
+    uint64_t readVersion = version.load(memory_order_acquire);
+    while (readVersion & 1)
+    {
+        this_thread::yield();
+        readVersion = version.load(memory_order_acquire);
+    }
+    return readVersion;
+}
+
+// whether the node is unchanged since readLock returned readVersion, i.e. what was read from
+// it in the meantime is consistent
+bool VersionLock::validate(uint64_t readVersion)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return version.load(memory_order_relaxed) == readVersion;
+}
+
+// lock the node if it is unchanged since readLock returned readVersion
+bool VersionLock::upgrade(uint64_t readVersion)
+{
+    return version.compare_exchange_strong(readVersion, readVersion + 1, memory_order_acquire);
+}
+
+void VersionLock::writeLock()
+{
+    while (!upgrade(readLock()))
+    {
+    }
+}
+
+void VersionLock::writeUnlock()
+{
+    version.fetch_add(1, memory_order_release);
+}
+
+ConcurrentNode::ConcurrentNode(bool isLeaf)
+{
+    this->isLeaf = isLeaf;
+    this->size = 0;
+}
+
+ConcurrentLeaf::ConcurrentLeaf() : ConcurrentNode(true)
+{
+    this->next = NULL;
+}
+
+ConcurrentInner::ConcurrentInner() : ConcurrentNode(false)
+{
+}
+
+// the tree starts with an empty leaf as root, so the root is never NULL
+ConcurrentBPTree::ConcurrentBPTree() : root(new ConcurrentLeaf())
+{
+}
+
+ConcurrentBPTree::~ConcurrentBPTree()
+{
+    destroy(root.load());
+}
+
+// every node stays reachable from the root, the tree never drops a node
+void ConcurrentBPTree::destroy(ConcurrentNode *node)
+{
+    if (node->isLeaf)
+    {
+        delete (ConcurrentLeaf *)node;
+        return;
+    }
+    ConcurrentInner *inner = (ConcurrentInner *)node;
+    for (int i = 0; i <= inner->size; i++)
+    {
+        destroy(inner->children[i]);
+    }
+    delete inner;
+}
+
+// Insert Operation
+// a record inserted twice under the same key is only kept once
+void ConcurrentBPTree::insert(int key, byte *recordPtr)
+{
+    IndexEntry entry = {key, recordPtr};
+    while (!tryInsert(entry))
+    {
+    }
+}
+
+// one optimistic attempt at an insert, false if a node changed under it and it has to restart
+bool ConcurrentBPTree::tryInsert(IndexEntry entry)
+{
+    ConcurrentNode *node = root.load();
+    uint64_t version = node->lock.readLock();
+    if (node != root.load())
+    {
+        return false;
+    }
+    ConcurrentInner *parent = NULL;
+    uint64_t parentVersion = 0;
+    while (!node->isLeaf)
+    {
+        ConcurrentInner *inner = (ConcurrentInner *)node;
+        // split a full internal node on the way down, so that the split of a child always
+        // finds room in its parent
+        if (inner->size == CONCURRENT_NODE_KEYS)
+        {
+            splitNode(parent, parentVersion, node, version);
+            return false;
+        }
+        if (parent != NULL && !parent->lock.validate(parentVersion))
+        {
+            return false;
+        }
+        parent = inner;
+        parentVersion = version;
+        node = inner->children[childIndex(inner->keys, inner->size, entry)];
+        // the child pointer is only safe to follow if the node did not change while it was read
+        if (!inner->lock.validate(version))
+        {
+            return false;
+        }
+        version = node->lock.readLock();
+    }
+
+    ConcurrentLeaf *leaf = (ConcurrentLeaf *)node;
+    if (leaf->size == CONCURRENT_NODE_KEYS)
+    {
+        splitNode(parent, parentVersion, node, version);
+        return false;
+    }
+    if (!leaf->lock.upgrade(version))
+    {
+        return false;
+    }
+    // the leaf may have split between reading the child pointer and reading its version,
+    // which changes the parent
+    if (parent != NULL && !parent->lock.validate(parentVersion))
+    {
+        leaf->lock.writeUnlock();
+        return false;
+    }
+    int i = lowerBound(leaf->entries, leaf->size, entry);
+    if (i == leaf->size || entryLess(entry, leaf->entries[i]))
+    {
+        memmove(leaf->entries + i + 1, leaf->entries + i, (leaf->size - i) * sizeof(IndexEntry));
+        leaf->entries[i] = entry;
+        leaf->size++;
+    }
+    leaf->lock.writeUnlock();
+    return true;
+}
+
+// split a full node into two, adding the new node to the parent (or to a new root)
+// does nothing if the parent or the node changed since they were read, the caller restarts
+void ConcurrentBPTree::splitNode(ConcurrentInner *parent, uint64_t parentVersion, ConcurrentNode *node, uint64_t version)
+{
+    if (parent != NULL && !parent->lock.upgrade(parentVersion))
+    {
+        return;
+    }
+    if (!node->lock.upgrade(version))
+    {
+        if (parent != NULL)
+        {
+            parent->lock.writeUnlock();
+        }
+        return;
+    }
+    // a root without parent may have been split by another thread in the meantime
+    if (parent == NULL && node != root.load())
+    {
+        node->lock.writeUnlock();
+        return;
+    }
+
+    IndexEntry separator;
+    ConcurrentNode *newNode;
+    if (node->isLeaf)
+    {
+        ConcurrentLeaf *leaf = (ConcurrentLeaf *)node;
+        ConcurrentLeaf *newLeaf = new ConcurrentLeaf();
+        newLeaf->size = leaf->size / 2;
+        leaf->size -= newLeaf->size;
+        memcpy(newLeaf->entries, leaf->entries + leaf->size, newLeaf->size * sizeof(IndexEntry));
+        newLeaf->next = leaf->next;
+        separator = newLeaf->entries[0];
+        newNode = newLeaf;
+        // readers only reach the new leaf once it is filled
+        leaf->next = newLeaf;
+    }
+    else
+    {
+        // the middle key moves up to the parent
+        ConcurrentInner *inner = (ConcurrentInner *)node;
+        ConcurrentInner *newInner = new ConcurrentInner();
+        int middle = inner->size / 2;
+        separator = inner->keys[middle];
+        newInner->size = inner->size - middle - 1;
+        memcpy(newInner->keys, inner->keys + middle + 1, newInner->size * sizeof(IndexEntry));
+        memcpy(newInner->children, inner->children + middle + 1, (newInner->size + 1) * sizeof(ConcurrentNode *));
+        inner->size = middle;
+        newNode = newInner;
+    }
+
+    if (parent != NULL)
+    {
+        // the parent was not full when it was read and did not change since
+        int i = childIndex(parent->keys, parent->size, separator);
+        memmove(parent->keys + i + 1, parent->keys + i, (parent->size - i) * sizeof(IndexEntry));
+        memmove(parent->children + i + 2, parent->children + i + 1, (parent->size - i) * sizeof(ConcurrentNode *));
+        parent->keys[i] = separator;
+        parent->children[i + 1] = newNode;
+        parent->size++;
+    }
+    else
+    {
+        ConcurrentInner *newRoot = new ConcurrentInner();
+        newRoot->keys[0] = separator;
+        newRoot->children[0] = node;
+        newRoot->children[1] = newNode;
+        newRoot->size = 1;
+        root.store(newRoot);
+    }
+    node->lock.writeUnlock();
+    if (parent != NULL)
+    {
+        parent->lock.writeUnlock();
+    }
+}
+
+// find the leaf that may hold entry, without latching
+// returns NULL if a node changed on the way and the search has to restart, otherwise the
+// version of the leaf to validate what is read from it
+ConcurrentLeaf *ConcurrentBPTree::findLeaf(IndexEntry entry, uint64_t &version)
+{
+    ConcurrentNode *node = root.load();
+    version = node->lock.readLock();
+    if (node != root.load())
+    {
+        return NULL;
+    }
+    while (!node->isLeaf)
+    {
+        ConcurrentInner *inner = (ConcurrentInner *)node;
+        ConcurrentNode *child = inner->children[childIndex(inner->keys, inner->size, entry)];
+        if (!inner->lock.validate(version))
+        {
+            return NULL;
+        }
+        uint64_t childVersion = child->lock.readLock();
+        // the child may have split before its version was read
+        if (!inner->lock.validate(version))
+        {
+            return NULL;
+        }
+        node = child;
+        version = childVersion;
+    }
+    return (ConcurrentLeaf *)node;
+}
+
+// Remove Operation
+// removes every record of key, latching one leaf at a time from left to right
+void ConcurrentBPTree::remove(int key)
+{
+    // smaller than every entry of key
+    IndexEntry from = {key, NULL};
+    ConcurrentLeaf *leaf;
+    uint64_t version;
+    do
+    {
+        leaf = findLeaf(from, version);
+    } while (leaf == NULL || !leaf->lock.upgrade(version));
+
+    while (leaf != NULL)
+    {
+        int i = lowerBound(leaf->entries, leaf->size, from);
+        int j = i;
+        while (j < leaf->size && leaf->entries[j].key == key)
+        {
+            j++;
+        }
+        // the entries of key may go on in the next leaf
+        ConcurrentLeaf *next = j == leaf->size ? leaf->next : NULL;
+        memmove(leaf->entries + i, leaf->entries + j, (leaf->size - j) * sizeof(IndexEntry));
+        leaf->size -= j - i;
+        leaf->lock.writeUnlock();
+        leaf = next;
+        if (leaf != NULL)
+        {
+            leaf->lock.writeLock();
+        }
+    }
+}
+
+// search operation
+vector<byte *> ConcurrentBPTree::searchRecords(int key)
+{
+    return searchRange(key, key);
+}
+
+// search Range operation
+// every leaf is read without latching and validated, then its entries in the range are taken
+vector<byte *> ConcurrentBPTree::searchRange(int startKey, int endKey)
+{
+    vector<byte *> recordList;
+    if (startKey > endKey)
+    {
+        return recordList;
+    }
+    IndexEntry from = {startKey, NULL};
+    while (!tryScan(from, endKey, recordList))
+    {
+    }
+    return recordList;
+}
+
+// one optimistic attempt at a scan of the entries from `from` up to endKey, false if a node
+// changed under it; `from` is then past the entries already appended, the next attempt resumes
+// from there
+bool ConcurrentBPTree::tryScan(IndexEntry &from, int endKey, vector<byte *> &recordList)
+{
+    uint64_t version;
+    ConcurrentLeaf *leaf = findLeaf(from, version);
+    if (leaf == NULL)
+    {
+        return false;
+    }
+    while (true)
+    {
+        // copy the leaf before using anything read from it
+        IndexEntry entries[CONCURRENT_NODE_KEYS];
+        int size = max(0, min(leaf->size, CONCURRENT_NODE_KEYS));
+        memcpy(entries, leaf->entries, size * sizeof(IndexEntry));
+        ConcurrentLeaf *next = leaf->next;
+        if (!leaf->lock.validate(version))
+        {
+            return false;
+        }
+        for (int i = lowerBound(entries, size, from); i < size; i++)
+        {
+            if (entries[i].key > endKey)
+            {
+                return true;
+            }
+            recordList.push_back(entries[i].recordPtr);
+            // the smallest entry after this one
+            from = {entries[i].key, entries[i].recordPtr + 1};
+        }
+        if (next == NULL)
+        {
+            return true;
+        }
+        leaf = next;
+        version = leaf->lock.readLock();
+    }
+}
+
+// number of levels below the root
+int ConcurrentBPTree::getHeight()
+{
+    while (true)
+    {
+        ConcurrentNode *node = root.load();
+        uint64_t version = node->lock.readLock();
+        int height = 0;
+        bool valid = node == root.load();
+        while (valid && !node->isLeaf)
+        {
+            ConcurrentNode *child = ((ConcurrentInner *)node)->children[0];
+            valid = node->lock.validate(version);
+            if (valid)
+            {
+                node = child;
+                version = node->lock.readLock();
+                height++;
+            }
+        }
+        if (valid)
+        {
+            return height;
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+// Number of entries in a leaf and of keys in an internal node of a ConcurrentBPTree
+const int CONCURRENT_NODE_KEYS = 32;
+
+// An entry of a ConcurrentBPTree: a key and one of its records. Entries are ordered by key,
+// then by record pointer, so that every entry is unique and duplicate keys need no posting list
+struct IndexEntry
+{
+    int key;
+    byte *recordPtr;
+};
+
+// Version lock of a node for optimistic lock coupling. Readers take no latch: they note the
+// version before reading the node and validate that it did not change afterwards. Writers lock
+// the node exclusively, which bumps the version when they unlock it.
+// The version is odd while the node is locked.
+class VersionLock
+{
+private:
+    atomic<uint64_t> version;
+
+public:
+    VersionLock();
+    uint64_t readLock();
+    bool validate(uint64_t readVersion);
+    bool upgrade(uint64_t readVersion);
+    void writeLock();
+    void writeUnlock();
+};
+
+class ConcurrentNode
+{
+
+    friend class ConcurrentBPTree;
+
+protected:
+    VersionLock lock;
+    bool isLeaf;
+    int size;
+
+    ConcurrentNode(bool isLeaf);
+};
+
+class ConcurrentLeaf : public ConcurrentNode
+{
+
+    friend class ConcurrentBPTree;
+
+private:
+    IndexEntry entries[CONCURRENT_NODE_KEYS];
+    ConcurrentLeaf *next;
+
+    ConcurrentLeaf();
+};
+
+// keys[i] is the smallest entry in the subtree of children[i + 1]
+class ConcurrentInner : public ConcurrentNode
+{
+
+    friend class ConcurrentBPTree;
+
+private:
+    IndexEntry keys[CONCURRENT_NODE_KEYS];
+    ConcurrentNode *children[CONCURRENT_NODE_KEYS + 1];
+
+    ConcurrentInner();
+};
+
+// Thread-safe B+ tree in memory, indexing records by key with optimistic lock coupling:
+// searches latch nothing and restart when a node they read changed, inserts and removes only
+// latch the leaf they change, plus the parent when a node splits.
+// Full internal nodes are split on the way down, so a split never goes up more than one level.
+// remove does not merge nodes, so a node is never freed while a reader may still be reading it;
+// nodes are freed with the tree.
+class ConcurrentBPTree
+{
+private:
+    atomic<ConcurrentNode *> root;
+    bool tryInsert(IndexEntry entry);
+    void splitNode(ConcurrentInner *parent, uint64_t parentVersion, ConcurrentNode *node, uint64_t version);
+    ConcurrentLeaf *findLeaf(IndexEntry entry, uint64_t &version);
+    bool tryScan(IndexEntry &from, int endKey, vector<byte *> &recordList);
+    void destroy(ConcurrentNode *node);
+
+public:
+    ConcurrentBPTree();
+    ~ConcurrentBPTree();
+    ConcurrentBPTree(const ConcurrentBPTree &) = delete;
+    ConcurrentBPTree &operator=(const ConcurrentBPTree &) = delete;
+    void insert(int key, byte *recordPtr);
+    void remove(int key);
+    vector<byte *> searchRecords(int key);
+    vector<byte *> searchRange(int startKey, int endKey);
+    int getHeight();
+};
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ingest.h"
+
+// Size of the chunks the file is split into (bytes), each chunk is parsed as a whole by one thread
+const size_t INGEST_CHUNK_SIZE = 1 << 20;
+
+/**
+ * @brief Parse the lines (tconst, averageRating, numVotes separated by tabs) of a part of a TSV file
+ * 
+ * @param begin First byte of the first line
+ * @param end One past the newline of the last line
+ * @return Records in line order 
+ * @throw std::runtime_error if a line is malformed: a tconst longer than 10 characters, a field
+ * that is not a number or anything after numVotes
+ */
+std::vector<Record> parseRecords(const char *begin, const char *end) {
+    std::vector<Record> records;
+    const char *line = begin;
+    while (line < end) {
+        const char *lineEnd = std::find(line, end, '\n');
+        const char *fieldsEnd = lineEnd > line && lineEnd[-1] == '\r' ? lineEnd - 1 : lineEnd;
+        // Skip empty line
+        if (fieldsEnd == line) {
+            line = lineEnd + 1;
+            continue;
+        }
+
+        Record r;
+        const char *tab = std::find(line, fieldsEnd, '\t');
+        size_t tconstLength = tab - line;
+        if (tconstLength > sizeof(r.tconst)) {
+            throw std::runtime_error("tconst too long: " + std::string(line, fieldsEnd));
+        }
+        std::memset(r.tconst, 0, sizeof(r.tconst));
+        std::memcpy(r.tconst, line, tconstLength);
+
+        auto rating = std::from_chars(std::min(tab + 1, fieldsEnd), fieldsEnd, r.averageRating);
+        auto votes = rating.ptr < fieldsEnd && *rating.ptr == '\t'
+            ? std::from_chars(rating.ptr + 1, fieldsEnd, r.numVotes)
+            : std::from_chars_result{rating.ptr, std::errc::invalid_argument};
+        // numVotes must end the line
+        if (tab == fieldsEnd || rating.ec != std::errc() || votes.ec != std::errc() || votes.ptr != fieldsEnd) {
+            throw std::runtime_error("Malformed line: " + std::string(line, fieldsEnd));
+        }
+
+        records.push_back(r);
+        line = lineEnd + 1;
+    }
+    return records;
+}
+
+/**
+ * @brief A TSV file with a header line, mapped and split into newline-aligned chunks
+ */
+class TsvChunks {
+    private:
+        void *mapped;
+        size_t size;
+        // Start of each chunk, followed by the end of the last chunk
+        std::vector<const char *> bounds;
+    public:
+        TsvChunks(const char *filename);
+        ~TsvChunks();
+        int getNoOfChunks();
+        std::vector<Record> parseChunk(int chunk);
+};
+
+/**
+ * @brief Map a TSV file and split its lines after the header into chunks
+ * 
+ * @param filename Path of the TSV file
+ * @throw std::runtime_error if the file cannot be read
+ */
+TsvChunks::TsvChunks(const char *filename) {
+    this->mapped = NULL;
+    this->size = 0;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error(std::string("Cannot open ") + filename);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        throw std::runtime_error(std::string("Cannot stat ") + filename);
+    }
+    this->size = st.st_size;
+    if (this->size == 0) {
+        close(fd);
+        return;
+    }
+    void *mapped = mmap(NULL, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error(std::string("Cannot map ") + filename);
+    }
+    this->mapped = mapped;
+    madvise(mapped, this->size, MADV_SEQUENTIAL);
+    const char *data = (const char *) mapped;
+    const char *end = data + this->size;
+
+    // Skip first line
+    const char *begin = std::min(std::find(data, end, '\n') + 1, end);
+
+    // Chunk boundaries, each moved forward to the start of a line
+    this->bounds = {begin};
+    while (this->bounds.back() < end) {
+        const char *bound = this->bounds.back() + std::min(INGEST_CHUNK_SIZE, (size_t) (end - this->bounds.back()));
+        this->bounds.push_back(std::min(std::find(bound, end, '\n') + 1, end));
+    }
+}
+
+TsvChunks::~TsvChunks() {
+    if (this->mapped != NULL) {
+        munmap(this->mapped, this->size);
+    }
+}
+
+/**
+ * @brief Get the number of chunks
+ * 
+ * @return Number of chunks, 0 for an empty file 
+ */
+int TsvChunks::getNoOfChunks() {
+    return std::max(0, (int) this->bounds.size() - 1);
+}
+
+/**
+ * @brief Parse the lines of a chunk
+ * 
+ * @param chunk Chunk index
+ * @return Records in line order 
+ * @throw std::runtime_error if a line is malformed
+ */
+std::vector<Record> TsvChunks::parseChunk(int chunk) {
+    return parseRecords(this->bounds[chunk], this->bounds[chunk + 1]);
+}
+
+/**
+ * @brief Parse a TSV file with a header line in parallel, handing the records to a single
+ * consumer in file order
+ * 
+ * The file is mapped and split into newline-aligned chunks. Worker threads take chunks in
+ * order and parse them; the calling thread passes the parsed chunks to consume as they
+ * become ready, so storage and index writes stay on one thread.
+ * 
+ * @param filename Path of the TSV file
+ * @param noOfThreads Number of parsing threads (at least 1)
+ * @param consume Called with the records of each chunk, in file order
+ * @throw std::runtime_error if the file cannot be read or a line is malformed
+ */
+void ingestTsv(const char *filename, int noOfThreads, const std::function<void(std::vector<Record> &)> &consume) {
+    TsvChunks chunks(filename);
+    int noOfChunks = chunks.getNoOfChunks();
+
+    std::vector<std::promise<std::vector<Record>>> parsed(noOfChunks);
+    std::vector<std::future<std::vector<Record>>> ready;
+    for (auto &promise: parsed) {
+        ready.push_back(promise.get_future());
+    }
+    std::atomic<int> nextChunk(0);
+    auto worker = [&]() {
+        for (int chunk = nextChunk++; chunk < noOfChunks; chunk = nextChunk++) {
+            try {
+                parsed[chunk].set_value(chunks.parseChunk(chunk));
+            } catch (...) {
+                parsed[chunk].set_exception(std::current_exception());
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 0; i < std::min(noOfThreads, noOfChunks); i++) {
+        workers.emplace_back(worker);
+    }
+
+    // Consume in file order while later chunks are still being parsed
+    std::exception_ptr error;
+    for (int chunk = 0; chunk < noOfChunks; chunk++) {
+        try {
+            std::vector<Record> records = ready[chunk].get();
+            if (!error) {
+                consume(records);
+            }
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    for (auto &thread: workers) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * @brief Parse a TSV file with a header line in parallel, each worker thread consuming the
+ * chunks it parsed
+ * 
+ * Chunks are consumed concurrently and out of order, consume gets the index of the chunk to
+ * restore file order and the index of the worker to keep state per thread (e.g. a BlockWriter).
+ * After a chunk fails, workers take no new chunks.
+ * 
+ * @param filename Path of the TSV file
+ * @param noOfThreads Number of worker threads (at least 1)
+ * @param consume Called as consume(records, chunk index, worker index) on the worker threads
+ * @return Number of chunks
+ * @throw std::runtime_error if the file cannot be read or a line is malformed
+ */
+int ingestTsvConcurrently(const char *filename, int noOfThreads, const std::function<void(std::vector<Record> &, int, int)> &consume) {
+    TsvChunks chunks(filename);
+    int noOfChunks = chunks.getNoOfChunks();
+
+    std::atomic<int> nextChunk(0);
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    auto worker = [&](int workerIdx) {
+        for (int chunk = nextChunk++; chunk < noOfChunks; chunk = nextChunk++) {
+            try {
+                std::vector<Record> records = chunks.parseChunk(chunk);
+                consume(records, chunk, workerIdx);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                nextChunk = noOfChunks;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 0; i < std::min(noOfThreads, noOfChunks); i++) {
+        workers.emplace_back(worker, i);
+    }
+    for (auto &thread: workers) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return noOfChunks;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include "storage.h"
+
+std::vector<Record> parseRecords(const char *begin, const char *end);
+void ingestTsv(const char *filename, int noOfThreads, const std::function<void(std::vector<Record> &)> &consume);
+int ingestTsvConcurrently(const char *filename, int noOfThreads, const std::function<void(std::vector<Record> &, int, int)> &consume);
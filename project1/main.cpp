@@ -1,49 +1,135 @@
 #include <cstring>
+#include <algorithm>
+#include <thread>
+#include <memory>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include "storage.h"
 #include "bptree.h"
+#include "ingest.h"
+#include "scan.h"
 #include "storage.cpp"
+#include "pagefile.cpp"
+#include "postings.cpp"
 #include "bptree.cpp"
+#include "ingest.cpp"
+#include "scan.cpp"
 
 const int SIZE = 1e8;
 const int BLOCK_SIZE = 200;
-const int RECORD_SIZE = 18;
-
-void importData(Storage &storage, BPTree &bptree, const char* filename) {
-    std::ifstream dataFile(filename);
-    std::string line;
-
-    std::getline(dataFile, line); // Skip first line
-    while (std::getline(dataFile, line)){
-        std::stringstream buffer(line);
-        std::string token;
-        Record r;
-
-        // Parse line
-        std::getline(buffer, token, '\t');
-        std::memcpy(r.tconst, token.c_str(), 10);
-        buffer >> r.averageRating >> r.numVotes;
-
-        std::byte *recordPtr = storage.insertRecord(r);
-        //insert each record into bptree
-        bptree.insert(r.numVotes,recordPtr);
+// How records are stored in blocks: COMPACT_RECORDS encodes tconst in 4 bytes and the rating
+// in tenths in 2 bytes, for 10-byte records instead of the 18 bytes of TEXT_RECORDS
+const RecordEncoding RECORD_ENCODING = COMPACT_RECORDS;
+// How the records of a block are laid out: PAX_BLOCKS keeps a minipage per field, so that
+// a field of every record of a block is read as one aligned array
+const BlockLayout BLOCK_LAYOUT = ROW_BLOCKS;
+// Fraction of each B+ tree node filled by the bulk load
+const float FILL_FACTOR = 1.0;
+// Which block with free space a new record goes to
+const FreeSpacePolicy FREE_SPACE_POLICY = FIRST_FIT;
+// Number of B+ tree pages cached in memory when the tree is kept in an index file
+const int BUFFER_FRAMES = 4096;
+// Keep the number and rating sum of the records below every B+ tree entry, so that range
+// averages are read from the index (fewer keys fit in a node)
+const bool AUGMENTED_INDEX = false;
+// Store the records from all parsing threads at once, each into blocks of its own (the
+// placement of records in blocks then changes from run to run)
+const bool CONCURRENT_IMPORT = false;
+
+// B+ tree on numVotes, each node a block of the storage
+typedef BPTree<int, BLOCK_SIZE, std::less<int>, AUGMENTED_INDEX> NumVotesIndex;
+
+void importData(Storage &storage, NumVotesIndex &bptree, const char* filename) {
+    // (numVotes, record pointer) of every imported record, for the bulk load
+    std::vector<std::pair<int, std::byte *>> entries;
+
+    int noOfThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (CONCURRENT_IMPORT) {
+        // Every parsing thread stores its records with its own block writer, the entries of
+        // each chunk are kept apart to put them back in file order
+        std::vector<std::unique_ptr<BlockWriter>> writers;
+        for (int i = 0; i < noOfThreads; i++) {
+            writers.push_back(std::make_unique<BlockWriter>(storage));
+        }
+        std::vector<std::vector<std::pair<int, std::vector<std::pair<int, std::byte *>>>>> storedChunks(noOfThreads);
+        int noOfChunks = ingestTsvConcurrently(filename, noOfThreads, [&](std::vector<Record> &records, int chunk, int worker) {
+            std::vector<std::pair<int, std::byte *>> chunkEntries;
+            for (Record &r: records) {
+                chunkEntries.push_back({r.numVotes, writers[worker]->insertRecord(r)});
+            }
+            storedChunks[worker].push_back({chunk, std::move(chunkEntries)});
+        });
+        // give back the blocks the writers did not fill
+        writers.clear();
+
+        std::vector<std::vector<std::pair<int, std::byte *>>> chunkEntries(noOfChunks);
+        for (auto &workerChunks: storedChunks) {
+            for (auto &chunk: workerChunks) {
+                chunkEntries[chunk.first] = std::move(chunk.second);
+            }
+        }
+        for (auto &chunk: chunkEntries) {
+            entries.insert(entries.end(), chunk.begin(), chunk.end());
+        }
+    } else {
+        // Lines are parsed on all cores, records are stored on this thread in file order
+        ingestTsv(filename, noOfThreads, [&](std::vector<Record> &records) {
+            for (Record &r: records) {
+                std::byte *recordPtr = storage.insertRecord(r);
+                entries.push_back({r.numVotes, recordPtr});
+            }
+        });
     }
 
-    dataFile.close();
+    // build the bptree bottom-up from the records sorted by numVotes
+    // (stable sort keeps records with the same numVotes in file order)
+    std::stable_sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+        return a.first < b.first;
+    });
+    bptree.bulkLoad(entries, FILL_FACTOR);
 } 
 
-void experiment1(Storage &storage, BPTree &bptree) {
+void loadIndex(Storage &storage, NumVotesIndex &bptree) {
+    // (numVotes, record pointer) of every stored record, for the bulk load
+    std::vector<std::pair<int, std::byte *>> entries;
+
+    for (std::byte *recordPtr: storage.getAllRecordPtrs()) {
+        entries.push_back({storage.viewRecord(recordPtr).numVotes(), recordPtr});
+    }
+
+    // records come in block order, which is the import order of a fresh database
+    std::stable_sort(entries.begin(), entries.end(), [](const auto &a, const auto &b) {
+        return a.first < b.first;
+    });
+    bptree.bulkLoad(entries, FILL_FACTOR);
+}
+
+// Scan the data blocks for the records with numVotes in [startKey, endKey] without the
+// B+ tree, as a baseline for the index (blocks whose zone map rules out the range are skipped)
+void scanExperiment(Storage &storage, int startKey, int endKey) {
+    ScanPredicate predicate;
+    predicate.minNumVotes = startKey;
+    predicate.maxNumVotes = endKey;
+    TableScan scan(storage, predicate, std::max(1u, std::thread::hardware_concurrency()));
+    ScanAggregate aggregate = scan.aggregate();
+    std::cout << "Number of data blocks scanned (full scan): " << scan.getBlocksScanned() << '\n';
+    std::cout << "Number of data blocks skipped by zone maps (full scan): " << scan.getBlocksSkipped() << '\n';
+    std::cout << "Average rating (full scan): " << aggregate.sum / aggregate.count << '\n';
+}
+
+void experiment1(Storage &storage, NumVotesIndex &bptree) {
     std::cout << "\n---Experiment 1---\n";
 
     std::cout << "Number of data blocks: " << storage.getUsedBlocks() << '\n';
     int noOfNodes=0;
     bptree.getNoOfNodes(bptree.getRoot(),&noOfNodes);
-    std::cout << "Size of database: " << (storage.getUsedSize() + noOfNodes*BLOCK_SIZE) / 1000000.0 << " MB\n";
+    // posting pages of duplicate keys are index blocks as well
+    int noOfIndexBlocks = noOfNodes + bptree.getNoOfPostingPages();
+    std::cout << "Size of database: " << (storage.getUsedSize() + noOfIndexBlocks*BLOCK_SIZE) / 1000000.0 << " MB\n";
 }
 
-void experiment2(BPTree &bptree){
+void experiment2(NumVotesIndex &bptree){
     std::cout << "\n---Experiment 2---\n";
     std::cout <<"Parameter n: "<< bptree.getNodeKeys() << '\n';
     int noOfNodes = 0;
@@ -56,19 +142,21 @@ void experiment2(BPTree &bptree){
     bptree.getRootChildContents();
 }
 
-void experiment3(Storage &storage, BPTree &bptree, int key){
+void experiment3(Storage &storage, NumVotesIndex &bptree, int key){
     std::cout << "\n---Experiment 3---\n";
 
     vector<byte *> recordPtrs = bptree.searchRecords(key);
 
-    vector<Record> records;
-    vector<int> blockIndices;
-    std::tie(records, blockIndices) = storage.getRecords(recordPtrs);
-
+    // Read the ratings in place, keeping the distinct blocks in access order
     float totalAverageRating = 0;
-    for (Record r: records) {
-        totalAverageRating += r.averageRating;
-    }
+    vector<int> blockIndices;
+    std::unordered_set<int> visited;
+    storage.visitRecords(recordPtrs, [&](RecordView r, int blockIdx) {
+        totalAverageRating += r.averageRating();
+        if (visited.insert(blockIdx).second) {
+            blockIndices.push_back(blockIdx);
+        }
+    });
     
     std::cout << "Number of data blocks accessed:" << blockIndices.size() << '\n';
 
@@ -83,36 +171,32 @@ void experiment3(Storage &storage, BPTree &bptree, int key){
     }
 
     std::cout << "Average rating: "<< totalAverageRating / recordPtrs.size() <<'\n';
+    if (bptree.isAugmented()) {
+        Aggregate aggregate = bptree.aggregateRange(key, key);
+        std::cout << "Average rating (from index): " << aggregate.sum / aggregate.count << '\n';
+    }
+    scanExperiment(storage, key, key);
 }
 
-void experiment4(Storage &storage, BPTree &bptree, int startKey, int endKey){
+void experiment4(Storage &storage, NumVotesIndex &bptree, int startKey, int endKey){
     std::cout << "\n---Experiment 4---\n";
-    vector<byte *> recordPtrs=bptree.searchRange(startKey,endKey);
-
     vector<int> blockIndexes;
+    std::unordered_set<int> visited;
     float avgRating=0;
-    
-    //get all blocks accessed
-    for (int i=0;i<recordPtrs.size();i++){
-        byte *recordAdd=recordPtrs[i];
-        Record r;
-        int blockIdx;
-        r=get<0>(storage.getRecord(recordAdd));
-        avgRating+=r.averageRating;
-        blockIdx=get<1>(storage.getRecord(recordAdd));
-        if ( std::find(blockIndexes.begin(), blockIndexes.end(), blockIdx) == blockIndexes.end() ){
-            blockIndexes.push_back(blockIdx);
-        }
-        uintptr_t intPtr = reinterpret_cast<uintptr_t>(recordAdd);
-        uintptr_t storagePtr = reinterpret_cast<uintptr_t>(storage.getStoragePtr());
+    int noOfRecords=0;
 
-        if ((intPtr+RECORD_SIZE-1-storagePtr+1)>BLOCK_SIZE){
-            if ( std::find(blockIndexes.begin(), blockIndexes.end(), blockIdx+1) == blockIndexes.end() ){
-                blockIndexes.push_back(blockIdx+1);
+    //stream the records of the range, getting all blocks accessed (a record never spans 2 blocks)
+    NumVotesIndex::RangeCursor cursor=bptree.seek(startKey,endKey);
+    for (byte *recordPtr=cursor.next(); recordPtr!=NULL; recordPtr=cursor.next()){
+        storage.visitRecord(recordPtr, [&](RecordView r, int blockIdx) {
+            avgRating+=r.averageRating();
+            if (visited.insert(blockIdx).second){
+                blockIndexes.push_back(blockIdx);
             }
-        }
-
+        });
+        noOfRecords++;
     }
+    cursor.printAccessStats();
     std::cout <<"Number of data blocks accessed:"<<blockIndexes.size()<<'\n';
 
     //print contents of block
@@ -125,20 +209,20 @@ void experiment4(Storage &storage, BPTree &bptree, int startKey, int endKey){
         std::cout <<"\n";
     }
     //calculate average rating
-    avgRating/=recordPtrs.size();
+    avgRating/=noOfRecords;
     std::cout <<"Average rating: "<<avgRating<<'\n';
-
+    if (bptree.isAugmented()){
+        Aggregate aggregate=bptree.aggregateRange(startKey,endKey);
+        std::cout <<"Average rating (from index): "<<aggregate.sum/aggregate.count<<'\n';
+    }
+    scanExperiment(storage, startKey, endKey);
 }
-void experiment5(Storage &storage, BPTree &bptree, int key) {
+void experiment5(Storage &storage, NumVotesIndex &bptree, int key) {
     std::cout << "\n---Experiment 5---\n";
-    vector<byte *> recordPtrs=bptree.searchRecords(key);
-    for (int j = 0; j < recordPtrs.size(); j++)
-    {
-        Record r;
-        r=get<0>(storage.getRecord(recordPtrs[j]));
-        storage.deleteRecord(recordPtrs[j]);
-    }
-    bptree.remove(key);
+    // removes the key and deletes its records from the storage, a block at a time
+    int noOfRecords = bptree.removeRange(key, key);
+    std::cout << "Number of records deleted: " << noOfRecords << '\n';
+    std::cout << "Number of data blocks: " << storage.getUsedBlocks() << '\n';
     int size = 0;
     bptree.getNoOfNodes(bptree.getRoot(), &size);
     std::cout << "No. of nodes: " << size << '\n';
@@ -149,11 +233,23 @@ void experiment5(Storage &storage, BPTree &bptree, int key) {
     bptree.getRootChildContents();
 }
 
-int main() {
-    Storage storage(SIZE, BLOCK_SIZE, RECORD_SIZE);
-    BPTree bptree(BLOCK_SIZE);
+int main(int argc, char **argv) {
+    // Keep the records and the index in memory, or in the data file given as the first
+    // argument and its index file next to it
+    std::string indexFile = argc > 1 ? std::string(argv[1]) + ".idx" : "";
+    Storage storage = argc > 1
+        ? Storage(argv[1], SIZE, BLOCK_SIZE, RECORD_ENCODING, BLOCK_LAYOUT, FREE_SPACE_POLICY)
+        : Storage(SIZE, BLOCK_SIZE, RECORD_ENCODING, BLOCK_LAYOUT, FREE_SPACE_POLICY);
+    NumVotesIndex bptree = argc > 1
+        ? NumVotesIndex(storage, indexFile.c_str(), BUFFER_FRAMES)
+        : NumVotesIndex(storage);
     
-    importData(storage, bptree, "./data.tsv");
+    // A reopened data file already holds the records, and its index unless the index file is missing
+    if (storage.getUsedBlocks() == 0) {
+        importData(storage, bptree, "./data.tsv");
+    } else if (bptree.getRoot() == NULL) {
+        loadIndex(storage, bptree);
+    }
 
     experiment1(storage, bptree);
     experiment2(bptree);
@@ -0,0 +1,370 @@
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pagefile.h"
+
+// Identifies a page file written by PageFile
+const char PAGE_FILE_MAGIC[8] = {'C', 'Z', '4', '0', '3', '1', 'I', 'X'};
+// Pages are aligned to a cache line
+const int PAGE_ALIGNMENT = 64;
+
+/**
+ * @brief Construct a new PageFile object held in memory
+ * 
+ * @param pageSize Page size in bytes
+ * @throw std::invalid_argument if a page cannot hold the file header
+ */
+PageFile::PageFile(int pageSize) {
+    if (pageSize < (int) sizeof(FileHeader)) {
+        throw std::invalid_argument("Page size too small for a page file");
+    }
+    this->pageSize = pageSize;
+    this->noOfPages = 1;
+    this->freeList = NO_PAGE;
+    this->noOfFreePages = 0;
+    this->fd = -1;
+    this->maxFrames = INT_MAX;
+    this->clockHand = 0;
+    this->noOfHits = 0;
+    this->noOfReads = 0;
+    this->noOfWrites = 0;
+
+    // The header page is never resident, it only keeps page ids the same in both modes
+    this->frameOfPage.push_back(-1);
+}
+
+/**
+ * @brief Construct a new PageFile object backed by a page file, reopening the file if it
+ * exists and creating it otherwise. No page is read until it is accessed.
+ * 
+ * @param path Path of the page file
+ * @param pageSize Page size in bytes
+ * @param noOfFrames Number of frames of the buffer pool
+ * @throw std::invalid_argument if a page cannot hold the file header or there is no frame
+ * @throw std::runtime_error if the file cannot be opened or was written with another page size
+ */
+PageFile::PageFile(const char *path, int pageSize, int noOfFrames) : PageFile(pageSize) {
+    if (noOfFrames < 1) {
+        throw std::invalid_argument("A buffer pool needs at least 1 frame");
+    }
+    this->maxFrames = noOfFrames;
+
+    this->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (this->fd == -1) {
+        throw std::runtime_error(std::string("Cannot open page file ") + path);
+    }
+    struct stat st;
+    fstat(this->fd, &st);
+    if (st.st_size == 0) {
+        return;
+    }
+
+    FileHeader header;
+    if (pread(this->fd, &header, sizeof(header), 0) != sizeof(header) ||
+        std::memcmp(header.magic, PAGE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.pageSize != pageSize || header.noOfPages < 1 ||
+        st.st_size < (off_t) header.noOfPages * pageSize) {
+        close(this->fd);
+        throw std::runtime_error(std::string("Page file has another layout: ") + path);
+    }
+    this->noOfPages = header.noOfPages;
+    this->freeList = header.freeList;
+    this->noOfFreePages = header.noOfFreePages;
+    this->frameOfPage.resize(this->noOfPages, -1);
+}
+
+PageFile::~PageFile() {
+    try {
+        this->flush();
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << '\n';
+    }
+    for (auto &frame: this->frames) {
+        ::operator delete(frame.data, std::align_val_t(PAGE_ALIGNMENT));
+    }
+    if (this->fd != -1) {
+        close(this->fd);
+    }
+}
+
+/**
+ * @brief Allocate a zeroed, aligned buffer for a frame
+ * 
+ * @return Pointer to the buffer 
+ */
+std::byte* PageFile::createFrame() {
+    void *data = ::operator new(this->pageSize, std::align_val_t(PAGE_ALIGNMENT));
+    std::memset(data, 0, this->pageSize);
+    return (std::byte*) data;
+}
+
+/**
+ * @brief Read a page from the file
+ * 
+ * @param pageId 
+ * @param data Buffer of pageSize bytes
+ * @throw std::runtime_error if the page cannot be read
+ */
+void PageFile::readPage(PageId pageId, std::byte *data) {
+    if (pread(this->fd, data, this->pageSize, (off_t) pageId * this->pageSize) != this->pageSize) {
+        throw std::runtime_error("Cannot read page " + std::to_string(pageId));
+    }
+    this->noOfReads++;
+}
+
+/**
+ * @brief Write a page to the file
+ * 
+ * @param pageId 
+ * @param data Buffer of pageSize bytes
+ * @throw std::runtime_error if the page cannot be written
+ */
+void PageFile::writePage(PageId pageId, std::byte *data) {
+    if (pwrite(this->fd, data, this->pageSize, (off_t) pageId * this->pageSize) != this->pageSize) {
+        throw std::runtime_error("Cannot write page " + std::to_string(pageId));
+    }
+    this->noOfWrites++;
+}
+
+/**
+ * @brief Take a frame for a page that is not resident: a new frame while the pool is not full,
+ * otherwise the frame of the page evicted by the CLOCK policy
+ * 
+ * @return Index of the empty frame 
+ * @throw std::runtime_error if every frame is pinned
+ */
+int PageFile::takeFrame() {
+    if ((int) this->frames.size() < this->maxFrames) {
+        this->frames.push_back({this->createFrame(), NO_PAGE, 0, false, false});
+        return this->frames.size() - 1;
+    }
+
+    // 2 sweeps clear every reference bit, an unpinned page is found by then if there is one
+    for (int step = 0; step < 2 * (int) this->frames.size(); step++) {
+        int f = this->clockHand;
+        this->clockHand = (this->clockHand + 1) % this->frames.size();
+        Frame &frame = this->frames[f];
+        if (frame.pinCount > 0) {
+            continue;
+        }
+        if (frame.referenced) {
+            frame.referenced = false;
+            continue;
+        }
+        if (frame.dirty) {
+            this->writePage(frame.pageId, frame.data);
+        }
+        this->frameOfPage[frame.pageId] = -1;
+        frame.pageId = NO_PAGE;
+        return f;
+    }
+    throw std::runtime_error("Every buffer frame is pinned");
+}
+
+/**
+ * @brief Get the frame of a page, reading the page in if it is not resident
+ * 
+ * @param pageId 
+ * @param isNew The page was just allocated, it is zeroed instead of read
+ * @return Index of the frame 
+ * @throw std::out_of_range if the page does not exist
+ */
+int PageFile::getFrame(PageId pageId, bool isNew) {
+    if (pageId <= NO_PAGE || pageId >= this->noOfPages) {
+        throw std::out_of_range("Page id out of range");
+    }
+
+    int f = this->frameOfPage[pageId];
+    if (f != -1) {
+        this->noOfHits++;
+        this->frames[f].referenced = true;
+        return f;
+    }
+
+    f = this->takeFrame();
+    Frame &frame = this->frames[f];
+    if (isNew) {
+        std::memset(frame.data, 0, this->pageSize);
+    } else {
+        this->readPage(pageId, frame.data);
+    }
+    frame.pageId = pageId;
+    frame.pinCount = 0;
+    frame.referenced = true;
+    frame.dirty = isNew;
+    this->frameOfPage[pageId] = f;
+    return f;
+}
+
+/**
+ * @brief Get a page without pinning it, the pointer is only valid until the next access
+ * to another page
+ * 
+ * @param pageId 
+ * @param forWrite The page is about to be changed
+ * @return Pointer to the resident copy of the page 
+ */
+std::byte* PageFile::getPage(PageId pageId, bool forWrite) {
+    Frame &frame = this->frames[this->getFrame(pageId, false)];
+    frame.dirty |= forWrite;
+    return frame.data;
+}
+
+/**
+ * @brief Get a page and pin it, the page stays resident until it is unpinned as often as pinned
+ * 
+ * @param pageId 
+ * @return Pointer to the resident copy of the page 
+ */
+std::byte* PageFile::pinPage(PageId pageId) {
+    Frame &frame = this->frames[this->getFrame(pageId, false)];
+    frame.pinCount++;
+    return frame.data;
+}
+
+/**
+ * @brief Unpin a pinned page
+ * 
+ * @param pageId 
+ * @param dirty The page was changed while it was pinned
+ */
+void PageFile::unpinPage(PageId pageId, bool dirty) {
+    Frame &frame = this->frames[this->frameOfPage[pageId]];
+    frame.pinCount--;
+    frame.dirty |= dirty;
+}
+
+/**
+ * @brief Allocate a zeroed page, reusing freed pages first
+ * 
+ * @return Id of the page 
+ */
+PageId PageFile::allocatePage() {
+    if (this->freeList != NO_PAGE) {
+        PageId pageId = this->freeList;
+        std::byte *page = this->getPage(pageId, true);
+        std::memcpy(&this->freeList, page, sizeof(PageId));
+        this->noOfFreePages--;
+        std::memset(page, 0, this->pageSize);
+        return pageId;
+    }
+    PageId pageId = this->noOfPages++;
+    this->frameOfPage.push_back(-1);
+    this->getFrame(pageId, true);
+    return pageId;
+}
+
+/**
+ * @brief Free a page, its first bytes are overwritten to chain it to the freed pages
+ * 
+ * @param pageId 
+ */
+void PageFile::freePage(PageId pageId) {
+    std::memcpy(this->getPage(pageId, true), &this->freeList, sizeof(PageId));
+    this->freeList = pageId;
+    this->noOfFreePages++;
+}
+
+/**
+ * @brief Write the header and every dirty resident page back to the page file and flush it
+ * to disk, does nothing for pages in memory
+ * 
+ * @throw std::runtime_error if a page cannot be written
+ */
+void PageFile::flush() {
+    if (this->fd == -1) {
+        return;
+    }
+
+    for (auto &frame: this->frames) {
+        if (frame.pageId != NO_PAGE && frame.dirty) {
+            this->writePage(frame.pageId, frame.data);
+            frame.dirty = false;
+        }
+    }
+
+    std::byte *headerPage = this->createFrame();
+    FileHeader header;
+    std::memcpy(header.magic, PAGE_FILE_MAGIC, sizeof(header.magic));
+    header.pageSize = this->pageSize;
+    header.noOfPages = this->noOfPages;
+    header.freeList = this->freeList;
+    header.noOfFreePages = this->noOfFreePages;
+    std::memcpy(headerPage, &header, sizeof(header));
+    bool written = pwrite(this->fd, headerPage, this->pageSize, 0) == this->pageSize;
+    ::operator delete(headerPage, std::align_val_t(PAGE_ALIGNMENT));
+    if (!written) {
+        throw std::runtime_error("Cannot write page file header");
+    }
+    fsync(this->fd);
+}
+
+/**
+ * @brief Checks if the pages are kept in a page file
+ * 
+ * @return true if there is a page file,
+ * @return false if the pages live in memory only
+ */
+bool PageFile::isFileBacked() {
+    return this->fd != -1;
+}
+
+/**
+ * @brief Get the page size in bytes
+ * 
+ * @return Page size in bytes 
+ */
+int PageFile::getPageSize() {
+    return this->pageSize;
+}
+
+/**
+ * @brief Get the number of pages, including the header page and freed pages
+ * 
+ * @return Number of pages 
+ */
+int PageFile::getNoOfPages() {
+    return this->noOfPages;
+}
+
+/**
+ * @brief Get the number of allocated pages, excluding the header page
+ * 
+ * @return Number of used pages 
+ */
+int PageFile::getUsedPages() {
+    return this->noOfPages - 1 - this->noOfFreePages;
+}
+
+/**
+ * @brief Get the number of page accesses that found the page resident
+ * 
+ * @return Number of buffer pool hits 
+ */
+long PageFile::getNoOfHits() {
+    return this->noOfHits;
+}
+
+/**
+ * @brief Get the number of page accesses that had to read the page from the file
+ * 
+ * @return Number of buffer pool misses (physical page reads) 
+ */
+long PageFile::getNoOfReads() {
+    return this->noOfReads;
+}
+
+/**
+ * @brief Get the number of pages written to the file, by evictions and flushes
+ * 
+ * @return Number of physical page writes 
+ */
+long PageFile::getNoOfWrites() {
+    return this->noOfWrites;
+}
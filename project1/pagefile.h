@@ -0,0 +1,88 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Identifies a page of a PageFile, page 0 holds the file header so it never refers to data
+typedef int PageId;
+const PageId NO_PAGE = 0;
+
+/**
+ * Fixed-size pages, kept in memory or in a page file. The pages of a file are cached in a
+ * buffer pool of a fixed number of frames: a page is read in on first access, and when
+ * every frame is taken the CLOCK policy evicts an unpinned page that was not referenced
+ * since the last sweep, writing it back first if it is dirty. Freed pages are chained
+ * through their first bytes and reused before the file grows.
+ */
+class PageFile {
+    private:
+        struct FileHeader {
+            char magic[8];
+            int pageSize;
+            // Number of pages, including the header page
+            int noOfPages;
+            // First page of the chain of freed pages
+            PageId freeList;
+            // Number of pages in the chain of freed pages
+            int noOfFreePages;
+        };
+
+        struct Frame {
+            std::byte *data;
+            // Page held by the frame, NO_PAGE if the frame is empty
+            PageId pageId;
+            // Number of pins, a pinned page is never evicted
+            int pinCount;
+            // Set on every access, cleared by the CLOCK hand passing by
+            bool referenced;
+            // The page was changed since it was read in
+            bool dirty;
+        };
+
+        // Page size (bytes)
+        int pageSize;
+        // Number of pages, including the header page
+        int noOfPages;
+        // First page of the chain of freed pages, NO_PAGE if none
+        PageId freeList;
+        // Number of pages in the chain of freed pages
+        int noOfFreePages;
+
+        // Descriptor of the page file, -1 if the pages live in memory only
+        int fd;
+        // Frames of the buffer pool, created as needed up to maxFrames
+        std::vector<Frame> frames;
+        // Maximum number of frames (unbounded in memory, where pages are never evicted)
+        int maxFrames;
+        // Frame of each page, -1 if the page is not resident
+        std::vector<int> frameOfPage;
+        // Next frame the CLOCK policy looks at
+        int clockHand;
+
+        // Buffer pool statistics, every miss is a physical read
+        long noOfHits;
+        long noOfReads;
+        long noOfWrites;
+
+        std::byte* createFrame();
+        void readPage(PageId pageId, std::byte *data);
+        void writePage(PageId pageId, std::byte *data);
+        int takeFrame();
+        int getFrame(PageId pageId, bool isNew);
+    public:
+        PageFile(int pageSize);
+        PageFile(const char *path, int pageSize, int noOfFrames);
+        ~PageFile();
+        std::byte* getPage(PageId pageId, bool forWrite = false);
+        std::byte* pinPage(PageId pageId);
+        void unpinPage(PageId pageId, bool dirty);
+        PageId allocatePage();
+        void freePage(PageId pageId);
+        void flush();
+        bool isFileBacked();
+        int getPageSize();
+        int getNoOfPages();
+        int getUsedPages();
+        long getNoOfHits();
+        long getNoOfReads();
+        long getNoOfWrites();
+};
@@ -0,0 +1,188 @@
+#include <cstring>
+#include <stdexcept>
+#include "postings.h"
+
+/**
+ * @brief Construct a new PostingPool object
+ * 
+ * @param pages Page file the pages are allocated from
+ * @param usedPages Number of pages already holding records, for a reopened page file
+ * @throw std::invalid_argument if a page cannot hold at least 2 record ids
+ */
+PostingPool::PostingPool(PageFile *pages, int usedPages) {
+    this->pages = pages;
+    this->pageCapacity = (pages->getPageSize() - (int) sizeof(PageHeader)) / (int) sizeof(RecordId);
+    this->usedPages = usedPages;
+
+    if (this->pageCapacity < 2) {
+        throw std::invalid_argument("Page size too small for a posting page");
+    }
+}
+
+/**
+ * @brief Get the header of a page, only valid until another page is accessed
+ * 
+ * @param pageId 
+ * @param forWrite The page is about to be changed
+ * @return Pointer to the header at the start of the page 
+ */
+PostingPool::PageHeader* PostingPool::getPage(PageId pageId, bool forWrite) {
+    return (PageHeader*) this->pages->getPage(pageId, forWrite);
+}
+
+/**
+ * @brief Get the record ids stored in a page, only valid until another page is accessed
+ * 
+ * @param pageId 
+ * @param forWrite The page is about to be changed
+ * @return Pointer to the array of record ids following the page header 
+ */
+RecordId* PostingPool::getPageRecords(PageId pageId, bool forWrite) {
+    return (RecordId*) (this->getPage(pageId, forWrite) + 1);
+}
+
+/**
+ * @brief Allocate an empty page from the page file
+ * 
+ * @return Id of the page 
+ */
+PageId PostingPool::allocatePage() {
+    PageId pageId = this->pages->allocatePage();
+    this->usedPages++;
+
+    PageHeader *page = this->getPage(pageId, true);
+    page->count = 0;
+    page->next = NO_PAGE;
+    page->last = pageId;
+    return pageId;
+}
+
+/**
+ * @brief Create a new posting list
+ * 
+ * @param recordId First record id of the list
+ * @return Id of the first page of the list 
+ */
+PageId PostingPool::create(RecordId recordId) {
+    PageId headPage = this->allocatePage();
+    this->append(headPage, recordId);
+    return headPage;
+}
+
+/**
+ * @brief Append a record id to the end of a posting list
+ * 
+ * @param headPage Id of the first page of the list
+ * @param recordId 
+ */
+void PostingPool::append(PageId headPage, RecordId recordId) {
+    PageId lastPage = this->getPage(headPage)->last;
+
+    // Chain a new page if the last one is full
+    if (this->getPage(lastPage)->count == this->pageCapacity) {
+        PageId newPage = this->allocatePage();
+        this->getPage(lastPage, true)->next = newPage;
+        this->getPage(headPage, true)->last = newPage;
+        lastPage = newPage;
+    }
+
+    PageHeader *last = this->getPage(lastPage, true);
+    this->getPageRecords(lastPage)[last->count++] = recordId;
+}
+
+/**
+ * @brief Get the record ids of a posting list, in insertion order
+ * 
+ * @param headPage Id of the first page of the list
+ * @param out Vector the record ids are appended to
+ */
+void PostingPool::getRecords(PageId headPage, std::vector<RecordId> &out) {
+    for (PageId pageId = headPage; pageId != NO_PAGE; pageId = this->getPage(pageId)->next) {
+        RecordId *records = this->getPageRecords(pageId);
+        out.insert(out.end(), records, records + this->getPage(pageId)->count);
+    }
+}
+
+/**
+ * @brief Get the number of record ids in a posting list
+ * 
+ * @param headPage Id of the first page of the list
+ * @return Number of record ids 
+ */
+int PostingPool::getNoOfRecords(PageId headPage) {
+    int count = 0;
+    for (PageId pageId = headPage; pageId != NO_PAGE; pageId = this->getPage(pageId)->next) {
+        count += this->getPage(pageId)->count;
+    }
+    return count;
+}
+
+/**
+ * @brief Get the number of pages of a posting list
+ * 
+ * @param headPage Id of the first page of the list
+ * @return Number of pages 
+ */
+int PostingPool::getNoOfPages(PageId headPage) {
+    int count = 0;
+    for (PageId pageId = headPage; pageId != NO_PAGE; pageId = this->getPage(pageId)->next) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Get the number of record ids in a single page of a posting list
+ * 
+ * @param pageId 
+ * @return Number of record ids 
+ */
+int PostingPool::getNoOfRecordsInPage(PageId pageId) {
+    return this->getPage(pageId)->count;
+}
+
+/**
+ * @brief Get a record id stored in a page of a posting list
+ * 
+ * @param pageId 
+ * @param index Index of the record id in the page
+ * @return Record id 
+ */
+RecordId PostingPool::getRecordInPage(PageId pageId, int index) {
+    return this->getPageRecords(pageId)[index];
+}
+
+/**
+ * @brief Get the page following a page of a posting list
+ * 
+ * @param pageId 
+ * @return Id of the next page, NO_PAGE for the last page 
+ */
+PageId PostingPool::getNextPage(PageId pageId) {
+    return this->getPage(pageId)->next;
+}
+
+/**
+ * @brief Release all pages of a posting list back to the page file
+ * 
+ * @param headPage Id of the first page of the list
+ */
+void PostingPool::release(PageId headPage) {
+    PageId pageId = headPage;
+    while (pageId != NO_PAGE) {
+        // Freeing overwrites the start of the page
+        PageId next = this->getPage(pageId)->next;
+        this->pages->freePage(pageId);
+        this->usedPages--;
+        pageId = next;
+    }
+}
+
+/**
+ * @brief Get the number of pages currently holding records
+ * 
+ * @return Number of used pages 
+ */
+int PostingPool::getUsedPages() {
+    return this->usedPages;
+}
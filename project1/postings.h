@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include "pagefile.h"
+#include "storage.h"
+
+/**
+ * Posting pages holding the record ids of duplicate keys, allocated from the page file
+ * of the B+ tree. The records of a key are a chain of pages; the first page of the chain
+ * is the handle kept in the B+ tree leaf.
+ */
+class PostingPool {
+    private:
+        struct PageHeader {
+            // Number of record ids in this page
+            int count;
+            // Next page of the chain, NO_PAGE for the last page
+            PageId next;
+            // Last page of the chain (only kept up to date in the first page)
+            PageId last;
+            int padding;
+        };
+
+        // Page file the pages are allocated from
+        PageFile *pages;
+        // Number of record ids that fit in a page
+        int pageCapacity;
+        // Number of pages currently holding records
+        int usedPages;
+
+        PageHeader* getPage(PageId pageId, bool forWrite = false);
+        RecordId* getPageRecords(PageId pageId, bool forWrite = false);
+        PageId allocatePage();
+    public:
+        PostingPool(PageFile *pages, int usedPages = 0);
+        PageId create(RecordId recordId);
+        void append(PageId headPage, RecordId recordId);
+        void getRecords(PageId headPage, std::vector<RecordId> &out);
+        int getNoOfRecords(PageId headPage);
+        int getNoOfPages(PageId headPage);
+        int getNoOfRecordsInPage(PageId pageId);
+        RecordId getRecordInPage(PageId pageId, int index);
+        PageId getNextPage(PageId pageId);
+        void release(PageId headPage);
+        int getUsedPages();
+};
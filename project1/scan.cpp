@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include "scan.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCAN_X86_SIMD
+#endif
+
+// Predicate kernels: each returns a bitmask with bit i set if numVotes[i] and averageRatings[i]
+// both lie within the bounds of the predicate, for i in [0, size) with size <= 64
+typedef uint64_t (*MatchBatchFn)(const int *, const float *, int, const ScanPredicate &);
+
+static uint64_t matchBatchScalar(const int *numVotes, const float *averageRatings, int size, const ScanPredicate &p) {
+    uint64_t matches = 0;
+    for (int i = 0; i < size; i++) {
+        bool match = numVotes[i] >= p.minNumVotes && numVotes[i] <= p.maxNumVotes &&
+                     averageRatings[i] >= p.minAverageRating && averageRatings[i] <= p.maxAverageRating;
+        matches |= (uint64_t) match << i;
+    }
+    return matches;
+}
+
+#ifdef SCAN_X86_SIMD
+// 4 slots at a time
+__attribute__((target("sse4.2"))) static uint64_t matchBatchSSE4(const int *numVotes, const float *averageRatings, int size, const ScanPredicate &p) {
+    __m128i minVotes = _mm_set1_epi32(p.minNumVotes);
+    __m128i maxVotes = _mm_set1_epi32(p.maxNumVotes);
+    __m128 minRating = _mm_set1_ps(p.minAverageRating);
+    __m128 maxRating = _mm_set1_ps(p.maxAverageRating);
+    uint64_t matches = 0;
+    int i = 0;
+    for (; i + 4 <= size; i += 4) {
+        __m128i votes = _mm_loadu_si128((const __m128i *) (numVotes + i));
+        __m128 ratings = _mm_loadu_ps(averageRatings + i);
+        // numVotes out of bounds, averageRating within them
+        __m128i votesOut = _mm_or_si128(_mm_cmpgt_epi32(minVotes, votes), _mm_cmpgt_epi32(votes, maxVotes));
+        __m128 ratingsIn = _mm_and_ps(_mm_cmpge_ps(ratings, minRating), _mm_cmple_ps(ratings, maxRating));
+        matches |= (uint64_t) _mm_movemask_ps(_mm_andnot_ps(_mm_castsi128_ps(votesOut), ratingsIn)) << i;
+    }
+    if (i < size) {
+        matches |= matchBatchScalar(numVotes + i, averageRatings + i, size - i, p) << i;
+    }
+    return matches;
+}
+
+// 8 slots at a time
+__attribute__((target("avx2"))) static uint64_t matchBatchAVX2(const int *numVotes, const float *averageRatings, int size, const ScanPredicate &p) {
+    __m256i minVotes = _mm256_set1_epi32(p.minNumVotes);
+    __m256i maxVotes = _mm256_set1_epi32(p.maxNumVotes);
+    __m256 minRating = _mm256_set1_ps(p.minAverageRating);
+    __m256 maxRating = _mm256_set1_ps(p.maxAverageRating);
+    uint64_t matches = 0;
+    int i = 0;
+    for (; i + 8 <= size; i += 8) {
+        __m256i votes = _mm256_loadu_si256((const __m256i *) (numVotes + i));
+        __m256 ratings = _mm256_loadu_ps(averageRatings + i);
+        __m256i votesOut = _mm256_or_si256(_mm256_cmpgt_epi32(minVotes, votes), _mm256_cmpgt_epi32(votes, maxVotes));
+        __m256 ratingsIn = _mm256_and_ps(_mm256_cmp_ps(ratings, minRating, _CMP_GE_OQ), _mm256_cmp_ps(ratings, maxRating, _CMP_LE_OQ));
+        matches |= (uint64_t) _mm256_movemask_ps(_mm256_andnot_ps(_mm256_castsi256_ps(votesOut), ratingsIn)) << i;
+    }
+    if (i < size) {
+        matches |= matchBatchSSE4(numVotes + i, averageRatings + i, size - i, p) << i;
+    }
+    return matches;
+}
+#endif
+
+/**
+ * @brief Pick the widest predicate kernel supported by the CPU
+ * 
+ * @return Predicate kernel
+ */
+static MatchBatchFn pickMatchBatch() {
+#ifdef SCAN_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return matchBatchAVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return matchBatchSSE4;
+    }
+#endif
+    return matchBatchScalar;
+}
+
+static uint64_t matchBatch(const int *numVotes, const float *averageRatings, int size, const ScanPredicate &p) {
+    static const MatchBatchFn simdMatchBatch = pickMatchBatch();
+    return simdMatchBatch(numVotes, averageRatings, size, p);
+}
+
+/**
+ * @brief Create a scan of a storage
+ * 
+ * @param storage
+ * @param predicate Records to keep
+ * @param noOfThreads Number of threads the blocks are split between (at least 1)
+ */
+TableScan::TableScan(Storage &storage, ScanPredicate predicate, int noOfThreads) {
+    this->storage = &storage;
+    this->predicate = predicate;
+    this->noOfThreads = std::max(1, noOfThreads);
+    this->blocksScanned = 0;
+    this->blocksSkipped = 0;
+}
+
+/**
+ * @brief Check if a block may hold a record matching the predicate
+ * 
+ * @param zoneMap Zone map of the block
+ * @return false if no record of the block matches, true otherwise 
+ */
+bool TableScan::mayMatch(const ZoneMap &zoneMap) {
+    return zoneMap.maxNumVotes >= this->predicate.minNumVotes && zoneMap.minNumVotes <= this->predicate.maxNumVotes &&
+           zoneMap.maxAverageRating >= this->predicate.minAverageRating && zoneMap.minAverageRating <= this->predicate.maxAverageRating;
+}
+
+/**
+ * @brief Scan a range of blocks a batch of slots at a time. A batch is the slots of a word of
+ * the occupancy bitmap, so it can span several blocks and words without records are skipped.
+ * Blocks whose zone map rules out the predicate are skipped as well.
+ * 
+ * @param firstBlock
+ * @param endBlock One past the last block
+ * @param consume Called as consume(firstSlot, matches, averageRatings) for every batch with a
+ * match, bit i of matches standing for slot firstSlot + i counted from the start of the storage
+ * @return Number of blocks read and skipped (blocks without records are neither)
+ */
+template <typename Consume>
+ScanBlocks TableScan::scanBlocks(int firstBlock, int endBlock, Consume &&consume) {
+    Storage *storage = this->storage;
+    int recordsPerBlock = storage->recordsPerBlock;
+    bool paxBlocks = storage->layout == PAX_BLOCKS;
+    bool ratingTenths = storage->encoding == COMPACT_RECORDS;
+    int numVotes[SCAN_BATCH_SLOTS] = {};
+    float averageRatings[SCAN_BATCH_SLOTS] = {};
+    ScanBlocks blocks = {0, 0};
+    // Last block counted in blocks and whether it was skipped, a block can span 2 batches
+    int lastBlock = -1;
+    bool lastBlockSkipped = false;
+
+    long endBit = (long) endBlock * recordsPerBlock;
+    for (long firstBit = (long) firstBlock * recordsPerBlock; firstBit < endBit;) {
+        long word = firstBit / SCAN_BATCH_SLOTS;
+        int size = std::min(endBit, (word + 1) * SCAN_BATCH_SLOTS) - firstBit;
+        uint64_t occupied = word < (long) storage->occupiedSlots.size() ? storage->occupiedSlots[word] >> (firstBit % SCAN_BATCH_SLOTS) : 0;
+        if (size < SCAN_BATCH_SLOTS) {
+            occupied &= ((uint64_t) 1 << size) - 1;
+        }
+        if (occupied == 0) {
+            firstBit += size;
+            continue;
+        }
+
+        // Gather the fields of the batch a run of slots of a block at a time: copied from the
+        // minipages of a PAX block, picked from the records of a row block. The slots of a
+        // skipped block are dropped from the batch.
+        for (int i = 0; i < size;) {
+            int blockIdx = (firstBit + i) / recordsPerBlock;
+            int slot = (firstBit + i) % recordsPerBlock;
+            int run = std::min(size - i, recordsPerBlock - slot);
+            uint64_t runSlots = (run == SCAN_BATCH_SLOTS ? ~(uint64_t) 0 : ((uint64_t) 1 << run) - 1) << i;
+            if ((occupied & runSlots) == 0) {
+                i += run;
+                continue;
+            }
+            if (blockIdx != lastBlock) {
+                lastBlock = blockIdx;
+                lastBlockSkipped = !this->mayMatch(storage->getZoneMap(blockIdx));
+                lastBlockSkipped ? blocks.skipped++ : blocks.read++;
+            }
+            if (lastBlockSkipped) {
+                occupied &= ~runSlots;
+                i += run;
+                continue;
+            }
+
+            std::byte *startBlockPtr = storage->storagePtr + (long) blockIdx * storage->blockSize;
+            if (paxBlocks) {
+                std::memcpy(numVotes + i, (const int *) (startBlockPtr + storage->numVotesOffset) + slot, run * sizeof(int));
+                if (ratingTenths) {
+                    const uint16_t *tenths = (const uint16_t *) (startBlockPtr + storage->averageRatingOffset) + slot;
+                    for (int j = 0; j < run; j++) {
+                        averageRatings[i + j] = tenths[j] / 10.0f;
+                    }
+                } else {
+                    std::memcpy(averageRatings + i, (const float *) (startBlockPtr + storage->averageRatingOffset) + slot, run * sizeof(float));
+                }
+            } else {
+                const std::byte *recordPtr = startBlockPtr + slot * storage->recordSize;
+                for (int j = i; j < i + run; j++, recordPtr += storage->recordSize) {
+                    std::memcpy(&numVotes[j], recordPtr + storage->numVotesOffset, sizeof(int));
+                    if (ratingTenths) {
+                        uint16_t tenths;
+                        std::memcpy(&tenths, recordPtr + storage->averageRatingOffset, sizeof(tenths));
+                        averageRatings[j] = tenths / 10.0f;
+                    } else {
+                        std::memcpy(&averageRatings[j], recordPtr + storage->averageRatingOffset, sizeof(float));
+                    }
+                }
+            }
+            i += run;
+        }
+
+        if (occupied == 0) {
+            firstBit += size;
+            continue;
+        }
+        uint64_t matches = matchBatch(numVotes, averageRatings, size, this->predicate) & occupied;
+        if (matches) {
+            consume(firstBit, matches, averageRatings);
+        }
+        firstBit += size;
+    }
+    return blocks;
+}
+
+/**
+ * @brief Split the used blocks into a contiguous range per thread and scan them
+ * 
+ * @param scanRange Called as scanRange(firstBlock, endBlock, result) on its own thread,
+ * returns the number of blocks it read and skipped
+ * @return Result of each range, in block order
+ */
+template <typename Result, typename ScanRange>
+std::vector<Result> TableScan::scanPartitions(ScanRange &&scanRange) {
+    int endBlock = this->storage->nextUnusedBlock;
+    int noOfPartitions = std::max(1, std::min(this->noOfThreads, endBlock));
+    std::vector<Result> results(noOfPartitions);
+    std::vector<ScanBlocks> blocks(noOfPartitions);
+    auto scanPartition = [&](int partition) {
+        int firstBlock = (long) endBlock * partition / noOfPartitions;
+        int lastBlock = (long) endBlock * (partition + 1) / noOfPartitions;
+        blocks[partition] = scanRange(firstBlock, lastBlock, results[partition]);
+    };
+
+    std::vector<std::thread> workers;
+    for (int partition = 1; partition < noOfPartitions; partition++) {
+        workers.emplace_back(scanPartition, partition);
+    }
+    scanPartition(0);
+    for (std::thread &thread: workers) {
+        thread.join();
+    }
+
+    this->blocksScanned = 0;
+    this->blocksSkipped = 0;
+    for (ScanBlocks &partitionBlocks: blocks) {
+        this->blocksScanned += partitionBlocks.read;
+        this->blocksSkipped += partitionBlocks.skipped;
+    }
+    return results;
+}
+
+/**
+ * @brief Get the record ids of the matching records
+ * 
+ * @return Record ids in block order
+ */
+std::vector<RecordId> TableScan::collect() {
+    auto results = this->scanPartitions<std::vector<RecordId>>([&](int firstBlock, int endBlock, std::vector<RecordId> &recordIds) {
+        int recordsPerBlock = this->storage->recordsPerBlock;
+        return this->scanBlocks(firstBlock, endBlock, [&](long firstSlot, uint64_t matches, const float *) {
+            for (; matches; matches &= matches - 1) {
+                long slot = firstSlot + __builtin_ctzll(matches);
+                recordIds.push_back((RecordId) (slot / recordsPerBlock) << 32 | (slot % recordsPerBlock));
+            }
+        });
+    });
+
+    std::vector<RecordId> recordIds = std::move(results[0]);
+    for (size_t i = 1; i < results.size(); i++) {
+        recordIds.insert(recordIds.end(), results[i].begin(), results[i].end());
+    }
+    return recordIds;
+}
+
+/**
+ * @brief Count the matching records and sum their ratings as they are scanned, without
+ * keeping them
+ * 
+ * @return Number and rating sum of the matching records
+ */
+ScanAggregate TableScan::aggregate() {
+    auto results = this->scanPartitions<ScanAggregate>([&](int firstBlock, int endBlock, ScanAggregate &aggregate) {
+        aggregate = {0, 0};
+        return this->scanBlocks(firstBlock, endBlock, [&](long, uint64_t matches, const float *averageRatings) {
+            aggregate.count += __builtin_popcountll(matches);
+            for (; matches; matches &= matches - 1) {
+                aggregate.sum += averageRatings[__builtin_ctzll(matches)];
+            }
+        });
+    });
+
+    ScanAggregate total = {0, 0};
+    for (ScanAggregate &aggregate: results) {
+        total.count += aggregate.count;
+        total.sum += aggregate.sum;
+    }
+    return total;
+}
+
+/**
+ * @brief Get the number of blocks the last scan read (blocks without records are not read)
+ * 
+ * @return Number of blocks
+ */
+int TableScan::getBlocksScanned() {
+    return this->blocksScanned;
+}
+
+/**
+ * @brief Get the number of blocks with records the last scan skipped through their zone maps
+ * 
+ * @return Number of blocks
+ */
+int TableScan::getBlocksSkipped() {
+    return this->blocksSkipped;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cmath>
+#include <climits>
+#include <vector>
+#include "storage.h"
+
+// Number of record slots whose predicate is evaluated at once, the slots of a word of the
+// occupancy bitmap of the storage
+const int SCAN_BATCH_SLOTS = 64;
+
+// Records a scan keeps: numVotes and averageRating both within their inclusive bounds
+struct ScanPredicate {
+    int minNumVotes = INT_MIN;
+    int maxNumVotes = INT_MAX;
+    float minAverageRating = -INFINITY;
+    float maxAverageRating = INFINITY;
+};
+
+// Number and rating sum of the records a scan kept
+struct ScanAggregate {
+    long long count;
+    double sum;
+};
+
+// Number of blocks a scan read, and of blocks with records it skipped through their zone maps
+struct ScanBlocks {
+    int read;
+    int skipped;
+};
+
+// Full scan of the used blocks of a storage, keeping the records that match a predicate
+// without going through an index. The predicate is evaluated with SIMD on batches of
+// consecutive slots, empty slots are dropped through the occupancy bitmap and blocks whose
+// zone map does not overlap the predicate are not read. With several threads each scans a
+// contiguous range of blocks. The storage must not change during a scan.
+class TableScan {
+    private:
+        Storage *storage;
+        ScanPredicate predicate;
+        int noOfThreads;
+        // Number of blocks read and skipped by the last scan
+        int blocksScanned;
+        int blocksSkipped;
+
+        bool mayMatch(const ZoneMap &zoneMap);
+        template <typename Consume>
+        ScanBlocks scanBlocks(int firstBlock, int endBlock, Consume &&consume);
+        template <typename Result, typename ScanRange>
+        std::vector<Result> scanPartitions(ScanRange &&scanRange);
+    public:
+        TableScan(Storage &storage, ScanPredicate predicate, int noOfThreads = 1);
+        std::vector<RecordId> collect();
+        ScanAggregate aggregate();
+        int getBlocksScanned();
+        int getBlocksSkipped();
+};
@@ -1,37 +1,561 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
 #include <cstring>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "storage.h"
 
+// Identifies a data file written by Storage
+const char STORAGE_FILE_MAGIC[8] = {'C', 'Z', '4', '0', '3', '1', 'D', 'B'};
+// Space reserved for the header at the start of a data file, the regions after it stay page aligned
+const size_t STORAGE_FILE_HEADER_SIZE = 4096;
+
+// Header of a data file, followed by the occupancy bitmap and then the blocks
+struct StorageFileHeader {
+    char magic[8];
+    int size;
+    int blockSize;
+    int recordSize;
+    int usedSize;
+    int usedBlocks;
+    int nextUnusedBlock;
+    int encoding;
+    int layout;
+    int noOfOverflowTconsts;
+};
+
+// Number of blocks getRecords prefetches ahead of the block it reads
+const int PREFETCH_BLOCKS = 4;
+// getRecords buckets the records by block index when there are at most this many blocks
+// in use per record fetched, and sorts them otherwise
+const size_t RADIX_BUCKETS_PER_RECORD = 4;
+// Size of a CPU cache line (bytes), the unit of a prefetch
+const int CACHE_LINE_SIZE = 64;
+
+// Record id of a free entry of the tconst index
+const RecordId EMPTY_ENTRY = ~(RecordId) 0;
+// Number of entries of an empty tconst index, a power of two
+const size_t TCONST_INDEX_MIN_ENTRIES = 1024;
+// The tconst index doubles when more than this fraction of its entries is in use
+const double TCONST_INDEX_MAX_LOAD = 0.7;
+
+// Zone map of a block without records
+const ZoneMap EMPTY_ZONE_MAP = {INT_MAX, INT_MIN, INFINITY, -INFINITY};
+
+// Minipages of a PAX block start at a multiple of this (bytes) from the start of the block
+const int MINIPAGE_ALIGNMENT = 4;
+// An encoded tconst "tt" + d digits (1 <= d <= 8) is d << ENCODED_TCONST_DIGITS_SHIFT | the number,
+// any other tconst is ENCODED_TCONST_OVERFLOW | its index among the overflow tconsts
+const int ENCODED_TCONST_MAX_DIGITS = 8;
+const int ENCODED_TCONST_DIGITS_SHIFT = 27;
+const uint32_t ENCODED_TCONST_OVERFLOW = (uint32_t) 1 << 31;
+// Suffix of the file holding the overflow tconsts of a data file
+const char OVERFLOW_FILE_SUFFIX[] = ".tconsts";
+
+/**
+ * @brief Construct a new RecordView object
+ * 
+ * @param ptr A pointer to the first byte of the record
+ * @param storage Storage holding the record, which knows how its records are encoded
+ */
+RecordView::RecordView(const std::byte *ptr, const Storage *storage) {
+    this->ptr = ptr;
+    this->storage = storage;
+}
+
+/**
+ * @brief Get the tconst of the record
+ * 
+ * @return tconst, without the padding of shorter ids 
+ */
+std::string RecordView::tconst() const {
+    const std::byte *field = this->storage->getFieldPtr(this->ptr, this->storage->tconstOffset, this->storage->tconstSize);
+    if (this->storage->encoding == TEXT_RECORDS) {
+        const char *tconst = (const char *) field;
+        return std::string(tconst, strnlen(tconst, sizeof(Record::tconst)));
+    }
+    uint32_t code;
+    std::memcpy(&code, field, sizeof(code));
+    return this->storage->decodeTconst(code);
+}
+
+/**
+ * @brief Get the average rating of the record
+ * 
+ * @return Average rating 
+ */
+float RecordView::averageRating() const {
+    const std::byte *field = this->storage->getFieldPtr(this->ptr, this->storage->averageRatingOffset, this->storage->averageRatingSize);
+    if (this->storage->encoding == COMPACT_RECORDS) {
+        uint16_t tenths;
+        std::memcpy(&tenths, field, sizeof(tenths));
+        return tenths / 10.0f;
+    }
+    float averageRating;
+    std::memcpy(&averageRating, field, sizeof(averageRating));
+    return averageRating;
+}
+
+/**
+ * @brief Get the number of votes of the record
+ * 
+ * @return Number of votes 
+ */
+int RecordView::numVotes() const {
+    int numVotes;
+    std::memcpy(&numVotes, this->storage->getFieldPtr(this->ptr, this->storage->numVotesOffset, sizeof(numVotes)), sizeof(numVotes));
+    return numVotes;
+}
+
+/**
+ * @brief Copy the record out of its block
+ * 
+ * @return Record 
+ */
+Record RecordView::toRecord() const {
+    Record r;
+    if (this->storage->encoding == TEXT_RECORDS) {
+        std::memcpy(&r.tconst, this->storage->getFieldPtr(this->ptr, this->storage->tconstOffset, this->storage->tconstSize), sizeof(r.tconst));
+    } else {
+        std::string tconst = this->tconst();
+        std::memset(r.tconst, 0, sizeof(r.tconst));
+        std::memcpy(r.tconst, tconst.data(), tconst.size());
+    }
+    r.averageRating = this->averageRating();
+    r.numVotes = this->numVotes();
+    return r;
+}
+
+/**
+ * @brief Construct a new, empty TconstIndex object
+ */
+TconstIndex::TconstIndex() {
+    this->clear();
+}
+
+/**
+ * @brief Pad a tconst with zeros to the fixed size of the keys
+ * 
+ * @param tconst 
+ * @param key Receives sizeof(Record::tconst) bytes
+ * @return false if the tconst is too long to be stored in a record
+ */
+bool TconstIndex::makeKey(std::string_view tconst, char *key) {
+    if (tconst.size() > sizeof(Record::tconst)) {
+        return false;
+    }
+    std::memset(key, 0, sizeof(Record::tconst));
+    std::memcpy(key, tconst.data(), tconst.size());
+    return true;
+}
+
+/**
+ * @brief Get the entry where the probe for a key starts
+ * 
+ * @param key Padded tconst
+ * @return Index of the entry 
+ */
+size_t TconstIndex::getHomeEntry(const char *key) {
+    // tconsts share their prefix and differ in the last digits, which all land in the hash
+    uint64_t head = 0;
+    uint16_t tail = 0;
+    std::memcpy(&head, key, sizeof(head));
+    std::memcpy(&tail, key + sizeof(head), sizeof(Record::tconst) - sizeof(head));
+    uint64_t hash = (head ^ (uint64_t) tail << 48 ^ tail) * 0x9E3779B97F4A7C15ull;
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ull;
+    hash ^= hash >> 32;
+    return hash & (this->entries.size() - 1);
+}
+
+/**
+ * @brief Double the number of entries, moving every key to its probe sequence in the new table
+ */
+void TconstIndex::grow() {
+    std::vector<Entry> old(this->entries.size() * 2);
+    std::swap(old, this->entries);
+    for (Entry &entry: this->entries) {
+        entry.recordId = EMPTY_ENTRY;
+    }
+    size_t mask = this->entries.size() - 1;
+    for (const Entry &entry: old) {
+        if (entry.recordId == EMPTY_ENTRY) {
+            continue;
+        }
+        size_t i = this->getHomeEntry(entry.tconst);
+        while (this->entries[i].recordId != EMPTY_ENTRY) {
+            i = (i + 1) & mask;
+        }
+        this->entries[i] = entry;
+    }
+}
+
+/**
+ * @brief Add the record id of a tconst
+ * 
+ * @param tconst 
+ * @param recordId 
+ * @throw std::invalid_argument if the tconst is longer than a record holds
+ */
+void TconstIndex::insert(std::string_view tconst, RecordId recordId) {
+    Entry entry;
+    if (!makeKey(tconst, entry.tconst)) {
+        throw std::invalid_argument("tconst too long");
+    }
+    entry.recordId = recordId;
+    if (this->noOfEntries + 1 > TCONST_INDEX_MAX_LOAD * this->entries.size()) {
+        this->grow();
+    }
+
+    size_t mask = this->entries.size() - 1;
+    size_t i = this->getHomeEntry(entry.tconst);
+    while (this->entries[i].recordId != EMPTY_ENTRY) {
+        i = (i + 1) & mask;
+    }
+    this->entries[i] = entry;
+    this->noOfEntries++;
+}
+
+/**
+ * @brief Remove the record id of a tconst, shifting the entries probed after it back so that
+ * no probe sequence is broken (the table keeps no tombstones)
+ * 
+ * @param tconst 
+ * @param recordId 
+ * @throw std::invalid_argument if the record is not in the index
+ */
+void TconstIndex::remove(std::string_view tconst, RecordId recordId) {
+    char key[sizeof(Record::tconst)];
+    if (!makeKey(tconst, key)) {
+        throw std::invalid_argument("Record not in the tconst index");
+    }
+    size_t mask = this->entries.size() - 1;
+    size_t hole = this->getHomeEntry(key);
+    while (this->entries[hole].recordId != recordId || std::memcmp(this->entries[hole].tconst, key, sizeof(key)) != 0) {
+        if (this->entries[hole].recordId == EMPTY_ENTRY) {
+            throw std::invalid_argument("Record not in the tconst index");
+        }
+        hole = (hole + 1) & mask;
+    }
+
+    // An entry after the hole moves into it unless its probe starts after the hole
+    for (size_t i = (hole + 1) & mask; this->entries[i].recordId != EMPTY_ENTRY; i = (i + 1) & mask) {
+        size_t home = this->getHomeEntry(this->entries[i].tconst);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            this->entries[hole] = this->entries[i];
+            hole = i;
+        }
+    }
+    this->entries[hole].recordId = EMPTY_ENTRY;
+    this->noOfEntries--;
+}
+
+/**
+ * @brief Find the record id of a tconst
+ * 
+ * @param tconst 
+ * @param recordId Receives the record id if the tconst is found
+ * @return true if a record has this tconst,
+ * @return false otherwise
+ */
+bool TconstIndex::find(std::string_view tconst, RecordId &recordId) {
+    char key[sizeof(Record::tconst)];
+    if (!makeKey(tconst, key)) {
+        return false;
+    }
+    size_t mask = this->entries.size() - 1;
+    for (size_t i = this->getHomeEntry(key); this->entries[i].recordId != EMPTY_ENTRY; i = (i + 1) & mask) {
+        if (std::memcmp(this->entries[i].tconst, key, sizeof(key)) == 0) {
+            recordId = this->entries[i].recordId;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Remove every entry, shrinking the table back to its initial size
+ */
+void TconstIndex::clear() {
+    this->entries.assign(TCONST_INDEX_MIN_ENTRIES, Entry());
+    for (Entry &entry: this->entries) {
+        entry.recordId = EMPTY_ENTRY;
+    }
+    this->noOfEntries = 0;
+}
+
+/**
+ * @brief Get the number of records in the index
+ * 
+ * @return Number of records 
+ */
+size_t TconstIndex::getNoOfEntries() {
+    return this->noOfEntries;
+}
+
+/**
+ * @brief Construct a new Storage object held in memory
+ * 
+ * @param size Storage size in bytes
+ * @param blockSize Block size in bytes
+ * @param encoding How the fields of the records are stored
+ * @param policy Which block with free space an insertion goes to
+ */
+Storage::Storage(int size, int blockSize, RecordEncoding encoding, BlockLayout layout, FreeSpacePolicy policy) {
+    this->initLayout(size, blockSize, encoding, layout, policy);
+
+    // Allocate memory
+    this->storagePtr = new std::byte[size];
+    this->fd = -1;
+    this->mappedPtr = NULL;
+    this->mappedSize = 0;
+}
+
+/**
+ * @brief Construct a new Storage object backed by a memory-mapped data file, reopening the file
+ * if it exists and creating it otherwise
+ * 
+ * The OS page cache decides which blocks are resident. The header and the occupancy bitmap
+ * are written back by sync() and on destruction, a file that was not closed cleanly may
+ * not reflect the last changes. Encoded records keep the tconsts that do not fit the encoding
+ * in a second file, the data file path followed by ".tconsts".
+ * 
+ * @param path Path of the data file
+ * @param size Storage size in bytes
+ * @param blockSize Block size in bytes
+ * @param encoding How the fields of the records are stored
+ * @param policy Which block with free space an insertion goes to
+ * @throw std::runtime_error if the file cannot be opened or mapped, or was written with another layout
+ */
+Storage::Storage(const char *path, int size, int blockSize, RecordEncoding encoding, BlockLayout layout, FreeSpacePolicy policy) {
+    this->initLayout(size, blockSize, encoding, layout, policy);
+    this->overflowPath = std::string(path) + OVERFLOW_FILE_SUFFIX;
+
+    this->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (this->fd == -1) {
+        throw std::runtime_error(std::string("Cannot open data file ") + path);
+    }
+    struct stat st;
+    fstat(this->fd, &st);
+    bool exists = st.st_size > 0;
+
+    this->mappedSize = STORAGE_FILE_HEADER_SIZE + this->getBitmapRegionSize() + size;
+    if (!exists && ftruncate(this->fd, this->mappedSize) == -1) {
+        close(this->fd);
+        throw std::runtime_error(std::string("Cannot resize data file ") + path);
+    }
+    if (exists && (size_t) st.st_size != this->mappedSize) {
+        close(this->fd);
+        throw std::runtime_error(std::string("Data file has another layout: ") + path);
+    }
+
+    void *mapped = mmap(NULL, this->mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(this->fd);
+        throw std::runtime_error(std::string("Cannot map data file ") + path);
+    }
+    this->mappedPtr = (std::byte *) mapped;
+    this->storagePtr = this->mappedPtr + STORAGE_FILE_HEADER_SIZE + this->getBitmapRegionSize();
+
+    if (exists) {
+        try {
+            this->loadFileState();
+        } catch (const std::runtime_error &e) {
+            munmap(this->mappedPtr, this->mappedSize);
+            close(this->fd);
+            throw;
+        }
+    } else {
+        this->sync();
+    }
+}
+
+Storage::~Storage() {
+    if (this->fd == -1) {
+        delete[] this->storagePtr;
+        return;
+    }
+    try {
+        this->sync();
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << '\n';
+    }
+    munmap(this->mappedPtr, this->mappedSize);
+    close(this->fd);
+}
+
 /**
- * @brief Construct a new Storage object
+ * @brief Set up the sizes, the record format and the empty free-space map, shared by both constructors
  * 
  * @param size Storage size in bytes
  * @param blockSize Block size in bytes
- * @param recordSize Record size in bytes
+ * @param encoding How the fields of the records are stored
+ * @param policy Which block with free space an insertion goes to
  */
-Storage::Storage(int size, int blockSize, int recordSize) {
+void Storage::initLayout(int size, int blockSize, RecordEncoding encoding, BlockLayout layout, FreeSpacePolicy policy) {
     this->size = size;
     this->usedSize = 0;
 
     this->blockSize = blockSize;
-    this->recordSize = recordSize;
+    this->encoding = encoding;
+    this->layout = layout;
+    this->tconstSize = encoding == TEXT_RECORDS ? sizeof(Record::tconst) : sizeof(uint32_t);
+    this->averageRatingSize = encoding == COMPACT_RECORDS ? sizeof(uint16_t) : sizeof(Record::averageRating);
+    this->recordSize = this->tconstSize + this->averageRatingSize + sizeof(Record::numVotes);
+    this->recordsPerBlock = blockSize / recordSize;
 
-    // Allocate memory
-    this->storagePtr = new std::byte[size];
-    // Point to the first byte of the storage
-    this->headPtr = this->storagePtr;
+    if (layout == ROW_BLOCKS) {
+        // Records are packed without padding, tconst first
+        this->tconstOffset = 0;
+        this->averageRatingOffset = this->tconstSize;
+        this->numVotesOffset = this->averageRatingOffset + this->averageRatingSize;
+    } else {
+        // Minipages of numVotes, averageRating and tconst, each aligned, with fewer slots if
+        // the alignment padding does not fit
+        auto align = [](int offset) {
+            return (offset + MINIPAGE_ALIGNMENT - 1) / MINIPAGE_ALIGNMENT * MINIPAGE_ALIGNMENT;
+        };
+        for (;; this->recordsPerBlock--) {
+            this->numVotesOffset = 0;
+            this->averageRatingOffset = align(this->numVotesOffset + this->recordsPerBlock * (int) sizeof(Record::numVotes));
+            this->tconstOffset = align(this->averageRatingOffset + this->recordsPerBlock * this->averageRatingSize);
+            if (this->tconstOffset + this->recordsPerBlock * this->tconstSize <= blockSize) {
+                break;
+            }
+        }
+    }
+
+    this->usedBlocks = 0;
+    this->noOfBlocks = size / blockSize;
+    this->nextUnusedBlock = 0;
+    this->occupiedSlots.resize(((long) this->noOfBlocks * this->recordsPerBlock + 63) / 64, 0);
+    this->zoneMaps.resize(this->noOfBlocks, EMPTY_ZONE_MAP);
+    this->staleZoneMaps.resize(this->noOfBlocks, 0);
 
-    // Save the available record locations
-    for (std::byte *ptr = this->storagePtr; ptr - this->storagePtr + 1 <= this->size; ptr += recordSize) {
-        this->availableRecordPtrs.insert(ptr);
+    this->policy = policy;
+    this->firstWordWithSpace = 0;
+    if (policy == MOST_FULL_FIRST) {
+        this->blocksByFreeSlots.resize(this->recordsPerBlock + 1);
     }
 }
 
-Storage::~Storage() {
-    delete[] this->storagePtr;
+/**
+ * @brief Get the space reserved for the occupancy bitmap of every block in a data file
+ * 
+ * @return Size in bytes, a multiple of the header size 
+ */
+size_t Storage::getBitmapRegionSize() {
+    size_t bytes = ((long) this->noOfBlocks * this->recordsPerBlock + 63) / 64 * 8;
+    return (bytes + STORAGE_FILE_HEADER_SIZE - 1) / STORAGE_FILE_HEADER_SIZE * STORAGE_FILE_HEADER_SIZE;
+}
+
+/**
+ * @brief Restore the counters, the occupancy bitmap and the free-space map from the data file
+ * 
+ * @throw std::runtime_error if the file was written with another layout
+ */
+void Storage::loadFileState() {
+    StorageFileHeader header;
+    std::memcpy(&header, this->mappedPtr, sizeof(header));
+    if (std::memcmp(header.magic, STORAGE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.size != this->size || header.blockSize != this->blockSize || header.recordSize != this->recordSize ||
+        header.encoding != this->encoding || header.layout != this->layout || header.nextUnusedBlock < 0 || header.nextUnusedBlock > this->noOfBlocks) {
+        throw std::runtime_error("Data file has another layout");
+    }
+    this->loadOverflowTconsts(header.noOfOverflowTconsts);
+
+    this->usedSize = header.usedSize;
+    this->usedBlocks = header.usedBlocks;
+
+    // Bitmap of the blocks taken into use
+    long words = ((long) header.nextUnusedBlock * this->recordsPerBlock + 63) / 64;
+    if (words > 0) {
+        std::memcpy(this->occupiedSlots.data(), this->mappedPtr + STORAGE_FILE_HEADER_SIZE, words * 8);
+    }
+
+    // Take the same blocks into use again, then record how full each is
+    while (this->nextUnusedBlock < header.nextUnusedBlock) {
+        int blockIdx = this->takeUnusedBlock();
+        int records = this->countRecords(blockIdx);
+        this->updateFreeSpace(blockIdx, this->recordsPerBlock, this->recordsPerBlock - records);
+    }
+
+    // The tconst index is not kept in the file
+    for (std::byte *startPtr: this->getAllRecordPtrs()) {
+        this->tconstIndex.insert(RecordView(startPtr, this).tconst(), this->getRecordId(startPtr));
+    }
+    // Nor are the zone maps, which are rebuilt as they are read
+    std::fill(this->staleZoneMaps.begin(), this->staleZoneMaps.begin() + this->nextUnusedBlock, 1);
+}
+
+/**
+ * @brief Write the header and the occupancy bitmap to a file-backed storage and flush it to disk,
+ * does nothing for a storage in memory
+ */
+void Storage::sync() {
+    if (this->fd == -1) {
+        return;
+    }
+
+    StorageFileHeader header;
+    std::memcpy(header.magic, STORAGE_FILE_MAGIC, sizeof(header.magic));
+    header.size = this->size;
+    header.blockSize = this->blockSize;
+    header.recordSize = this->recordSize;
+    header.usedSize = this->usedSize;
+    header.usedBlocks = this->usedBlocks;
+    header.nextUnusedBlock = this->nextUnusedBlock;
+    header.encoding = this->encoding;
+    header.layout = this->layout;
+    header.noOfOverflowTconsts = this->overflowTconsts.size();
+    std::memcpy(this->mappedPtr, &header, sizeof(header));
+    if (!this->occupiedSlots.empty()) {
+        std::memcpy(this->mappedPtr + STORAGE_FILE_HEADER_SIZE, this->occupiedSlots.data(), this->occupiedSlots.size() * 8);
+    }
+
+    msync(this->mappedPtr, this->mappedSize, MS_SYNC);
+
+    // Overflow tconsts are only ever added, the file is rewritten with all of them
+    if (!this->overflowTconsts.empty()) {
+        std::ofstream file(this->overflowPath, std::ios::binary | std::ios::trunc);
+        for (const std::string &tconst: this->overflowTconsts) {
+            char padded[sizeof(Record::tconst)] = {};
+            std::memcpy(padded, tconst.data(), tconst.size());
+            file.write(padded, sizeof(padded));
+        }
+        file.flush();
+        if (!file) {
+            throw std::runtime_error("Cannot write overflow tconsts to " + this->overflowPath);
+        }
+    }
+}
+
+/**
+ * @brief Read back the tconsts that did not fit the encoding of the records of a data file
+ * 
+ * @param noOfOverflowTconsts Number of overflow tconsts recorded in the header
+ * @throw std::runtime_error if the overflow file is missing or too short
+ */
+void Storage::loadOverflowTconsts(int noOfOverflowTconsts) {
+    if (noOfOverflowTconsts == 0) {
+        return;
+    }
+    std::ifstream file(this->overflowPath, std::ios::binary);
+    for (int i = 0; i < noOfOverflowTconsts; i++) {
+        char padded[sizeof(Record::tconst)];
+        if (!file.read(padded, sizeof(padded))) {
+            throw std::runtime_error("Missing overflow tconsts in " + this->overflowPath);
+        }
+        this->overflowCodes[std::string(padded, strnlen(padded, sizeof(padded)))] = i;
+        this->overflowTconsts.push_back(std::string(padded, strnlen(padded, sizeof(padded))));
+    }
 }
 
 /**
@@ -42,9 +566,12 @@ Storage::~Storage() {
  * @return false otherwise
  */
 bool Storage::isValidStartPtr(std::byte* startPtr) {
-    int offset = ((startPtr - this->storagePtr) % blockSize);
+    if (startPtr < this->storagePtr || startPtr - this->storagePtr >= (long) this->noOfBlocks * this->blockSize) {
+        return false; // not within size
+    }
+    int offset = this->getBlockOffset(startPtr);
     return (offset % recordSize) == 0 && // correct offset
-           (startPtr - this->storagePtr + 1) < this->size; // within size
+           offset / recordSize < this->recordsPerBlock; // record fits in the block
 }
 
 /**
@@ -67,6 +594,191 @@ int Storage::getBlockIndex(std::byte* startPtr) {
     return (startPtr - this->storagePtr) / this->blockSize;
 }
 
+/**
+ * @brief Get the slot index of a pointer within its block
+ * 
+ * @param startPtr 
+ * @return Slot index 
+ */
+int Storage::getSlotIndex(std::byte* startPtr) {
+    return this->getBlockOffset(startPtr) / this->recordSize;
+}
+
+/**
+ * @brief Checks if a record slot holds a record
+ * 
+ * @param blockIdx 
+ * @param slot 
+ * @return true if the slot is occupied,
+ * @return false otherwise
+ */
+bool Storage::isOccupied(int blockIdx, int slot) {
+    long bit = (long) blockIdx * this->recordsPerBlock + slot;
+    if (bit / 64 >= (long) this->occupiedSlots.size()) {
+        return false; // block never used
+    }
+    return (this->occupiedSlots[bit / 64] >> (bit % 64)) & 1;
+}
+
+/**
+ * @brief Mark a record slot as occupied or free
+ * 
+ * @param blockIdx 
+ * @param slot 
+ * @param occupied 
+ */
+void Storage::setOccupied(int blockIdx, int slot, bool occupied) {
+    long bit = (long) blockIdx * this->recordsPerBlock + slot;
+    if (occupied) {
+        this->occupiedSlots[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    } else {
+        this->occupiedSlots[bit / 64] &= ~((uint64_t) 1 << (bit % 64));
+    }
+}
+
+/**
+ * @brief Mask of the bits of a block that fall in a word of the occupancy bitmap
+ * 
+ * @param word Index of the word
+ * @param firstBit First bit of the block
+ * @param endBit One past the last bit of the block
+ * @return Mask of the block's bits in that word 
+ */
+static uint64_t blockBitsMask(long word, long firstBit, long endBit) {
+    long from = std::max(firstBit, word * 64) - word * 64;
+    long to = std::min(endBit, word * 64 + 64) - word * 64;
+    uint64_t mask = to == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << to) - 1;
+    return mask & ~(((uint64_t) 1 << from) - 1);
+}
+
+/**
+ * @brief Find the first free record slot of a block
+ * 
+ * @param blockIdx 
+ * @return Slot index, or -1 if the block is full 
+ */
+int Storage::findFreeSlot(int blockIdx) {
+    long firstBit = (long) blockIdx * this->recordsPerBlock;
+    long endBit = firstBit + this->recordsPerBlock;
+    for (long word = firstBit / 64; word * 64 < endBit; word++) {
+        uint64_t free = ~this->occupiedSlots[word] & blockBitsMask(word, firstBit, endBit);
+        if (free) {
+            return word * 64 + __builtin_ctzll(free) - firstBit;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Count the records in a block
+ * 
+ * @param blockIdx 
+ * @return Number of occupied slots 
+ */
+int Storage::countRecords(int blockIdx) {
+    long firstBit = (long) blockIdx * this->recordsPerBlock;
+    long endBit = firstBit + this->recordsPerBlock;
+    int count = 0;
+    for (long word = firstBit / 64; word * 64 < endBit && word < (long) this->occupiedSlots.size(); word++) {
+        count += __builtin_popcountll(this->occupiedSlots[word] & blockBitsMask(word, firstBit, endBit));
+    }
+    return count;
+}
+
+/**
+ * @brief Claim a block that was never used, safe to call from several threads at once
+ * 
+ * @return Block index, or -1 if every block has been used 
+ */
+int Storage::claimBlock() {
+    int blockIdx = this->nextUnusedBlock.load();
+    do {
+        if (blockIdx == this->noOfBlocks) {
+            return -1;
+        }
+    } while (!this->nextUnusedBlock.compare_exchange_weak(blockIdx, blockIdx + 1));
+    return blockIdx;
+}
+
+/**
+ * @brief Take a block that was never used to insert records into, adding it to the free-space map
+ * 
+ * @return Block index, or -1 if every block has been used 
+ */
+int Storage::takeUnusedBlock() {
+    int blockIdx = this->claimBlock();
+    if (blockIdx != -1) {
+        this->updateFreeSpace(blockIdx, 0, this->recordsPerBlock);
+    }
+    return blockIdx;
+}
+
+/**
+ * @brief Find a block in use that has a free slot, according to the free space policy
+ * 
+ * @return Block index, or -1 if every block in use is full 
+ */
+int Storage::findBlockWithSpace() {
+    if (this->policy == FIRST_FIT) {
+        for (int word = this->firstWordWithSpace; word < (int) this->blocksWithSpace.size(); word++) {
+            if (this->blocksWithSpace[word]) {
+                this->firstWordWithSpace = word;
+                return word * 64 + __builtin_ctzll(this->blocksWithSpace[word]);
+            }
+        }
+        this->firstWordWithSpace = this->blocksWithSpace.size();
+        return -1;
+    }
+
+    for (int freeSlots = 1; freeSlots <= this->recordsPerBlock; freeSlots++) {
+        if (!this->blocksByFreeSlots[freeSlots].empty()) {
+            return this->blocksByFreeSlots[freeSlots].back();
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Update the free-space map after the number of free slots of a block changed
+ * 
+ * @param blockIdx 
+ * @param oldFreeSlots Free slots before the change
+ * @param newFreeSlots Free slots after the change
+ */
+void Storage::updateFreeSpace(int blockIdx, int oldFreeSlots, int newFreeSlots) {
+    // Grow the free-space map to cover the block, blocks filled by block writers join it late
+    if (this->policy == FIRST_FIT && (int) this->blocksWithSpace.size() * 64 <= blockIdx) {
+        this->blocksWithSpace.resize(blockIdx / 64 + 1, 0);
+    }
+    if (this->policy == MOST_FULL_FIRST && (int) this->freeSlotsListPos.size() <= blockIdx) {
+        this->freeSlotsListPos.resize(blockIdx + 1, -1);
+    }
+
+    if (this->policy == FIRST_FIT) {
+        if (newFreeSlots > 0) {
+            this->blocksWithSpace[blockIdx / 64] |= (uint64_t) 1 << (blockIdx % 64);
+            this->firstWordWithSpace = std::min(this->firstWordWithSpace, blockIdx / 64);
+        } else {
+            this->blocksWithSpace[blockIdx / 64] &= ~((uint64_t) 1 << (blockIdx % 64));
+        }
+        return;
+    }
+
+    // Move the block from the list of oldFreeSlots to the list of newFreeSlots (full blocks are in no list)
+    if (oldFreeSlots > 0) {
+        std::vector<int> &list = this->blocksByFreeSlots[oldFreeSlots];
+        int pos = this->freeSlotsListPos[blockIdx];
+        list[pos] = list.back();
+        this->freeSlotsListPos[list[pos]] = pos;
+        list.pop_back();
+    }
+    if (newFreeSlots > 0) {
+        std::vector<int> &list = this->blocksByFreeSlots[newFreeSlots];
+        this->freeSlotsListPos[blockIdx] = list.size();
+        list.push_back(blockIdx);
+    }
+}
+
 /**
  * @brief Get the number of used blocks
  * 
@@ -97,16 +809,14 @@ std::vector<std::string> Storage::getBlockContent(int blockIdx) {
     }
 
     std::vector<std::string> content;
-    std::byte *startBlockPtr = this->storagePtr + blockIdx * this->blockSize;
-    char tconst[10];
+    std::byte *startBlockPtr = this->storagePtr + (long) blockIdx * this->blockSize;
 
-    for (std::byte *p = startBlockPtr; p < startBlockPtr + this->blockSize; p += this->recordSize) {
-        // Skip empty byte
-        if ((int) *p == 0x00) {
+    for (int slot = 0; slot < this->recordsPerBlock; slot++) {
+        // Skip empty slot
+        if (!this->isOccupied(blockIdx, slot)) {
             continue;
         }
-        std::memcpy(tconst, p, 10);
-        content.push_back(std::string((char *) tconst));
+        content.push_back(RecordView(startBlockPtr + slot * this->recordSize, this).tconst());
     }
     return content;
 }
@@ -138,10 +848,78 @@ int Storage::getRecordSize() {
     return this->recordSize;
 }
 
+/**
+ * @brief Get how the fields of the records are stored
+ * 
+ * @return Record encoding 
+ */
+RecordEncoding Storage::getEncoding() {
+    return this->encoding;
+}
+
+/**
+ * @brief Get how the records of a block are laid out
+ * 
+ * @return Block layout 
+ */
+BlockLayout Storage::getLayout() {
+    return this->layout;
+}
+
+/**
+ * @brief Get the minipages of a PAX block, to scan a field of all of its slots at once
+ * (empty slots hold zeros)
+ * 
+ * @param blockIdx 
+ * @return Minipages of the block 
+ * @throw std::logic_error if the blocks are not PAX blocks
+ * @throw std::invalid_argument if the block index is out of range
+ */
+BlockColumns Storage::getBlockColumns(int blockIdx) {
+    if (this->layout != PAX_BLOCKS) {
+        throw std::logic_error("Columns require PAX blocks");
+    }
+    if (blockIdx < 0 || blockIdx >= this->noOfBlocks) {
+        throw std::invalid_argument("Block index out of range");
+    }
+    std::byte *startBlockPtr = this->storagePtr + (long) blockIdx * this->blockSize;
+    BlockColumns columns;
+    columns.numVotes = (const int *) (startBlockPtr + this->numVotesOffset);
+    columns.averageRatings = this->encoding == COMPACT_RECORDS ? NULL : (const float *) (startBlockPtr + this->averageRatingOffset);
+    columns.ratingTenths = this->encoding == COMPACT_RECORDS ? (const uint16_t *) (startBlockPtr + this->averageRatingOffset) : NULL;
+    return columns;
+}
+
 std::byte* Storage::getStoragePtr(){
     return this->storagePtr;
 }
 
+/**
+ * @brief Get the id of a record from a pointer to its first byte
+ * 
+ * @param startPtr 
+ * @return Record id 
+ * @throw std::invalid_argument if the starting pointer is invalid
+ */
+RecordId Storage::getRecordId(std::byte* startPtr) {
+    if (!this->isValidStartPtr(startPtr)) {
+        throw std::invalid_argument("Invalid starting pointer");
+    }
+    return (RecordId) this->getBlockIndex(startPtr) << 32 | this->getSlotIndex(startPtr);
+}
+
+/**
+ * @brief Get a pointer to the first byte of a record from its id
+ * 
+ * @param recordId 
+ * @return Pointer to the first byte of the record 
+ */
+std::byte* Storage::getRecordPtr(RecordId recordId) {
+    long blockIdx = recordId >> 32;
+    int slot = recordId & 0xffffffff;
+    return this->storagePtr + blockIdx * this->blockSize + slot * this->recordSize;
+}
+
 /**
  * @brief Get the record and the block indices that are accessed based on a starting pointer to the record
  * 
@@ -150,55 +928,330 @@ std::byte* Storage::getStoragePtr(){
  * @throw std::invalid_argument if the starting pointer is invalid
  */
 std::tuple<Record, int> Storage::getRecord(std::byte* startPtr) {
+    return {this->viewRecord(startPtr).toRecord(), this->getBlockIndex(startPtr)};
+}
+
+/**
+ * @brief Hint the CPU to start loading a block into its caches
+ * 
+ * @param blockIdx Block index
+ */
+void Storage::prefetchBlock(int blockIdx) {
+#if defined(__GNUC__)
+    const std::byte *blockPtr = this->storagePtr + (long) blockIdx * this->blockSize;
+    for (int offset = 0; offset < this->blockSize; offset += CACHE_LINE_SIZE) {
+        __builtin_prefetch(blockPtr + offset);
+    }
+#endif
+}
+
+/**
+ * @brief Get the records and the block indices accessed based on starting pointers to records
+ * 
+ * The records are read block by block in block order, so each block is read once however the
+ * pointers are ordered, while the blocks a few steps ahead are prefetched
+ * 
+ * @param startPtrs Vector of pointers to the first byte of records
+ * @param blockOrder Return the records grouped by block in block order (in the order of startPtrs
+ * within a block) instead of the order of startPtrs
+ * @return Tuple of (vector of records, vector of accessed block indices in block order)
+ * @throw std::invalid_argument if a starting pointer is invalid
+ */
+std::tuple<std::vector<Record>, std::vector<int>> Storage::getRecords(const std::vector<std::byte *> &startPtrs, bool blockOrder) {
+    std::vector<int> blockIndices;
+    blockIndices.reserve(startPtrs.size());
+    for (std::byte *startPtr: startPtrs) {
+        if (!this->isValidStartPtr(startPtr) || !this->isOccupied(this->getBlockIndex(startPtr), this->getSlotIndex(startPtr))) {
+            throw std::invalid_argument("Invalid starting pointer");
+        }
+        blockIndices.push_back(this->getBlockIndex(startPtr));
+    }
+
+    // Positions in startPtrs grouped by block in block order, keeping the order of startPtrs within a block
+    std::vector<uint32_t> order(startPtrs.size());
+    if ((size_t) this->nextUnusedBlock <= RADIX_BUCKETS_PER_RECORD * startPtrs.size()) {
+        // Bucket by block index in O(records + blocks)
+        std::vector<uint32_t> bucketStart(this->nextUnusedBlock + 1, 0);
+        for (int blockIdx: blockIndices) {
+            bucketStart[blockIdx + 1]++;
+        }
+        for (int blockIdx = 0; blockIdx < this->nextUnusedBlock; blockIdx++) {
+            bucketStart[blockIdx + 1] += bucketStart[blockIdx];
+        }
+        for (uint32_t i = 0; i < startPtrs.size(); i++) {
+            order[bucketStart[blockIndices[i]]++] = i;
+        }
+    } else {
+        // Few records over many blocks, sort (block index, position) keys instead
+        std::vector<uint64_t> keys(startPtrs.size());
+        for (uint32_t i = 0; i < startPtrs.size(); i++) {
+            keys[i] = (uint64_t) blockIndices[i] << 32 | i;
+        }
+        std::sort(keys.begin(), keys.end());
+        for (size_t i = 0; i < keys.size(); i++) {
+            order[i] = keys[i] & 0xffffffff;
+        }
+    }
+
+    // Distinct blocks to read, in block order
+    std::vector<int> accessedBlockIndices;
+    for (uint32_t pos: order) {
+        if (accessedBlockIndices.empty() || accessedBlockIndices.back() != blockIndices[pos]) {
+            accessedBlockIndices.push_back(blockIndices[pos]);
+        }
+    }
+
+    std::vector<Record> records(startPtrs.size());
+    for (size_t i = 0; i < (size_t) PREFETCH_BLOCKS && i < accessedBlockIndices.size(); i++) {
+        this->prefetchBlock(accessedBlockIndices[i]);
+    }
+    size_t next = 0;
+    for (size_t i = 0; i < accessedBlockIndices.size(); i++) {
+        if (i + PREFETCH_BLOCKS < accessedBlockIndices.size()) {
+            this->prefetchBlock(accessedBlockIndices[i + PREFETCH_BLOCKS]);
+        }
+        // Every record of the block, the block is not visited again
+        for (; next < order.size() && blockIndices[order[next]] == accessedBlockIndices[i]; next++) {
+            size_t pos = blockOrder ? next : order[next];
+            records[pos] = RecordView(startPtrs[order[next]], this).toRecord();
+        }
+    }
+
+    return {records, accessedBlockIndices};
+}
+
+/**
+ * @brief Get a view of a record that reads its fields in place
+ * 
+ * @param startPtr A pointer to the first byte of the record 
+ * @return View of the record, valid until the record is deleted
+ * @throw std::invalid_argument if the starting pointer is invalid
+ */
+RecordView Storage::viewRecord(std::byte* startPtr) {
     // Wrong starting pointer or not occupied
-    if (!this->isValidStartPtr(startPtr) || this->availableRecordPtrs.count(startPtr)) {
+    if (!this->isValidStartPtr(startPtr) || !this->isOccupied(this->getBlockIndex(startPtr), this->getSlotIndex(startPtr))) {
         throw std::invalid_argument("Invalid starting pointer");
     }
+    return RecordView(startPtr, this);
+}
 
-    std::byte *ptr = startPtr;
+/**
+ * @brief Get pointers to every record in the storage, in block order
+ * 
+ * @return Vector of pointers to the first byte of the records 
+ */
+std::vector<std::byte *> Storage::getAllRecordPtrs() {
+    std::vector<std::byte *> startPtrs;
+    for (int blockIdx = 0; blockIdx < this->nextUnusedBlock; blockIdx++) {
+        for (int slot = 0; slot < this->recordsPerBlock; slot++) {
+            if (this->isOccupied(blockIdx, slot)) {
+                startPtrs.push_back(this->storagePtr + (long) blockIdx * this->blockSize + slot * this->recordSize);
+            }
+        }
+    }
+    return startPtrs;
+}
 
-    Record r;
-    std::memcpy(&r.tconst, ptr, sizeof(r.tconst));
-    ptr += sizeof(r.tconst);
+/**
+ * @brief Find a record by its tconst through the tconst index, without scanning the blocks
+ * 
+ * @param tconst 
+ * @return A pointer to the first byte of the record, or NULL if no record has this tconst 
+ */
+std::byte* Storage::findRecord(std::string_view tconst) {
+    RecordId recordId;
+    if (!this->tconstIndex.find(tconst, recordId)) {
+        return NULL;
+    }
+    return this->getRecordPtr(recordId);
+}
 
-    std::memcpy(&r.averageRating, ptr, sizeof(r.averageRating));
-    ptr += sizeof(r.averageRating);
+/**
+ * @brief Encode a tconst in 32 bits: "tt" and 1 to 8 digits is encoded by its number of
+ * digits and its value, any other tconst is added to the overflow tconsts if needed
+ * 
+ * @param tconst 
+ * @return Code of the tconst 
+ */
+uint32_t Storage::encodeTconst(std::string_view tconst) {
+    int digits = tconst.size() - 2;
+    if (digits >= 1 && digits <= ENCODED_TCONST_MAX_DIGITS && tconst[0] == 't' && tconst[1] == 't') {
+        uint32_t value = 0;
+        int i = 2;
+        for (; i < (int) tconst.size() && tconst[i] >= '0' && tconst[i] <= '9'; i++) {
+            value = value * 10 + (tconst[i] - '0');
+        }
+        if (i == (int) tconst.size()) {
+            return (uint32_t) digits << ENCODED_TCONST_DIGITS_SHIFT | value;
+        }
+    }
 
-    std::memcpy(&r.numVotes, ptr, sizeof(r.numVotes));
-    ptr += sizeof(r.numVotes);
+    // Block writers may add overflow tconsts at the same time
+    std::lock_guard<std::mutex> lock(this->freeSpaceMutex);
+    auto found = this->overflowCodes.find(std::string(tconst));
+    if (found != this->overflowCodes.end()) {
+        return ENCODED_TCONST_OVERFLOW | found->second;
+    }
+    uint32_t index = this->overflowTconsts.size();
+    this->overflowTconsts.push_back(std::string(tconst));
+    this->overflowCodes[std::string(tconst)] = index;
+    return ENCODED_TCONST_OVERFLOW | index;
+}
 
-    int blockIdx = this->getBlockIndex(startPtr);
+/**
+ * @brief Decode a tconst encoded by encodeTconst
+ * 
+ * @param code 
+ * @return tconst 
+ */
+std::string Storage::decodeTconst(uint32_t code) const {
+    if (code & ENCODED_TCONST_OVERFLOW) {
+        return this->overflowTconsts[code & ~ENCODED_TCONST_OVERFLOW];
+    }
+    int digits = code >> ENCODED_TCONST_DIGITS_SHIFT;
+    uint32_t value = code & (((uint32_t) 1 << ENCODED_TCONST_DIGITS_SHIFT) - 1);
+    char tconst[2 + ENCODED_TCONST_MAX_DIGITS];
+    tconst[0] = 't';
+    tconst[1] = 't';
+    for (int i = 1 + digits; i >= 2; i--) {
+        tconst[i] = '0' + value % 10;
+        value /= 10;
+    }
+    return std::string(tconst, 2 + digits);
+}
 
-    return {r, blockIdx};
+/**
+ * @brief Get a field of a record, which follows the start of the record in a row block and
+ * sits in the minipage of the field in a PAX block
+ * 
+ * @param startPtr A pointer to the first byte of the record (in a PAX block, the place the
+ * record would start at in a row block)
+ * @param fieldOffset Offset of the field in a record, or of its minipage
+ * @param fieldSize Size of the field
+ * @return A pointer to the first byte of the field 
+ */
+std::byte* Storage::getFieldPtr(const std::byte *startPtr, int fieldOffset, int fieldSize) const {
+    if (this->layout == ROW_BLOCKS) {
+        return (std::byte *) startPtr + fieldOffset;
+    }
+    long offset = startPtr - this->storagePtr;
+    long startBlockOffset = offset / this->blockSize * this->blockSize;
+    int slot = (offset - startBlockOffset) / this->recordSize;
+    return this->storagePtr + startBlockOffset + fieldOffset + slot * fieldSize;
 }
 
 /**
- * @brief Get the records and the block indices accessed based on starting pointers to records
+ * @brief Copy the fields of a record to its place in a block, encoding them as the storage does
  * 
- * @param startPtrs Vector of pointers to the first byte of records
- * @return Tuple of (vector of records, vector of accessed block indices)
+ * @param startPtr A pointer to the first byte of the record 
+ * @param r Record 
+ * @throw std::invalid_argument if the average rating cannot be stored in tenths in 16 bits
  */
-std::tuple<std::vector<Record>, std::vector<int>> Storage::getRecords(std::vector<std::byte *> startPtrs) {
-    std::vector<Record> records;
-    std::vector<int> accessedBlockIndices;
-    std::unordered_set<int> visited;
+void Storage::writeRecord(std::byte *startPtr, const Record &r) {
+    if (this->encoding == COMPACT_RECORDS) {
+        long tenths = std::lround(r.averageRating * 10);
+        if (tenths < 0 || tenths > UINT16_MAX) {
+            throw std::invalid_argument("Average rating out of range of compact records");
+        }
+        uint16_t storedTenths = tenths;
+        std::memcpy(this->getFieldPtr(startPtr, this->averageRatingOffset, this->averageRatingSize), &storedTenths, sizeof(storedTenths));
+    } else {
+        std::memcpy(this->getFieldPtr(startPtr, this->averageRatingOffset, this->averageRatingSize), &r.averageRating, sizeof(r.averageRating));
+    }
+    std::byte *tconstPtr = this->getFieldPtr(startPtr, this->tconstOffset, this->tconstSize);
+    if (this->encoding == TEXT_RECORDS) {
+        std::memcpy(tconstPtr, &r.tconst, sizeof(r.tconst));
+    } else {
+        uint32_t code = this->encodeTconst(std::string_view(r.tconst, strnlen(r.tconst, sizeof(r.tconst))));
+        std::memcpy(tconstPtr, &code, sizeof(code));
+    }
+    std::memcpy(this->getFieldPtr(startPtr, this->numVotesOffset, sizeof(r.numVotes)), &r.numVotes, sizeof(r.numVotes));
+}
 
-    for (auto startPtr: startPtrs) {
-        Record r;
-        int blockIdx;
+/**
+ * @brief Clear the fields of a deleted record
+ * 
+ * @param startPtr A pointer to the first byte of the record 
+ */
+void Storage::clearRecord(std::byte *startPtr) {
+    if (this->layout == ROW_BLOCKS) {
+        std::memset(startPtr, 0x00, this->recordSize);
+        return;
+    }
+    std::memset(this->getFieldPtr(startPtr, this->tconstOffset, this->tconstSize), 0x00, this->tconstSize);
+    std::memset(this->getFieldPtr(startPtr, this->averageRatingOffset, this->averageRatingSize), 0x00, this->averageRatingSize);
+    std::memset(this->getFieldPtr(startPtr, this->numVotesOffset, sizeof(Record::numVotes)), 0x00, sizeof(Record::numVotes));
+}
 
-        std::tie(r, blockIdx) = this->getRecord(startPtr);
+/**
+ * @brief Widen the zone map of a block to a record inserted into it
+ * 
+ * @param blockIdx 
+ * @param startPtr A pointer to the first byte of the record 
+ */
+void Storage::widenZoneMap(int blockIdx, const std::byte *startPtr) {
+    RecordView r(startPtr, this);
+    ZoneMap &zoneMap = this->zoneMaps[blockIdx];
+    zoneMap.minNumVotes = std::min(zoneMap.minNumVotes, r.numVotes());
+    zoneMap.maxNumVotes = std::max(zoneMap.maxNumVotes, r.numVotes());
+    zoneMap.minAverageRating = std::min(zoneMap.minAverageRating, r.averageRating());
+    zoneMap.maxAverageRating = std::max(zoneMap.maxAverageRating, r.averageRating());
+}
 
-        if (!visited.count(blockIdx)) {
-            accessedBlockIndices.push_back(blockIdx);
-            visited.insert(blockIdx);
-        }
+/**
+ * @brief Update the zone map of a block for a record about to be deleted from it: the zone map
+ * turns stale if the record is at one of its bounds, it still covers the block otherwise
+ * 
+ * @param blockIdx 
+ * @param startPtr A pointer to the first byte of the record 
+ * @param blockEmptied Whether the record is the last one of the block
+ */
+void Storage::shrinkZoneMap(int blockIdx, const std::byte *startPtr, bool blockEmptied) {
+    if (blockEmptied) {
+        this->zoneMaps[blockIdx] = EMPTY_ZONE_MAP;
+        this->staleZoneMaps[blockIdx] = 0;
+        return;
+    }
+    RecordView r(startPtr, this);
+    const ZoneMap &zoneMap = this->zoneMaps[blockIdx];
+    if (r.numVotes() == zoneMap.minNumVotes || r.numVotes() == zoneMap.maxNumVotes ||
+        r.averageRating() == zoneMap.minAverageRating || r.averageRating() == zoneMap.maxAverageRating) {
+        this->staleZoneMaps[blockIdx] = 1;
+    }
+}
 
-        // Keep track of fetched records and block accesses
-        records.push_back(r);
+/**
+ * @brief Recompute the zone map of a block from its records
+ * 
+ * @param blockIdx 
+ */
+void Storage::rebuildZoneMap(int blockIdx) {
+    this->zoneMaps[blockIdx] = EMPTY_ZONE_MAP;
+    std::byte *startBlockPtr = this->storagePtr + (long) blockIdx * this->blockSize;
+    for (int slot = 0; slot < this->recordsPerBlock; slot++) {
+        if (this->isOccupied(blockIdx, slot)) {
+            this->widenZoneMap(blockIdx, startBlockPtr + slot * this->recordSize);
+        }
     }
+    this->staleZoneMaps[blockIdx] = 0;
+}
 
-    return {records, accessedBlockIndices};
+/**
+ * @brief Get the zone map of a block, rebuilding it first if it is stale. Calls for different
+ * blocks may run on several threads at once.
+ * 
+ * @param blockIdx 
+ * @return Bounds of the numVotes and averageRating of the records of the block 
+ * @throw std::invalid_argument if the block index is out of range
+ */
+ZoneMap Storage::getZoneMap(int blockIdx) {
+    if (blockIdx < 0 || blockIdx >= this->noOfBlocks) {
+        throw std::invalid_argument("Block index out of range");
+    }
+    if (this->staleZoneMaps[blockIdx]) {
+        this->rebuildZoneMap(blockIdx);
+    }
+    return this->zoneMaps[blockIdx];
 }
 
 /**
@@ -209,34 +1262,34 @@ std::tuple<std::vector<Record>, std::vector<int>> Storage::getRecords(std::vecto
  * @throw std::runtime_error if the storage is already full
  */
 std::byte* Storage::insertRecord(Record r) {
-    if (this->availableRecordPtrs.empty()) {
+    std::string_view tconst(r.tconst, strnlen(r.tconst, sizeof(r.tconst)));
+
+    // Prefer a block in use with free slots, then a block that was never used
+    int blockIdx = this->findBlockWithSpace();
+    if (blockIdx == -1) {
+        blockIdx = this->takeUnusedBlock();
+    }
+    if (blockIdx == -1) {
         throw std::runtime_error("Storage is already full");
     }
 
-    std::byte* startPtr = this->headPtr;
+    int slot = this->findFreeSlot(blockIdx);
+    std::byte* startPtr = this->storagePtr + (long) blockIdx * this->blockSize + slot * this->recordSize;
+    int records = this->countRecords(blockIdx);
 
-    // Record inserted to a new empty block
-    if (this->getBlockOffset(this->headPtr) == 0) {
+    // Copy the record to the storage
+    this->writeRecord(startPtr, r);
+    this->tconstIndex.insert(tconst, (RecordId) blockIdx << 32 | slot);
+    this->widenZoneMap(blockIdx, startPtr);
+
+    // Record inserted to an empty block
+    if (records == 0) {
         this->usedBlocks++;
     }
 
     // Update markings
-    this->availableRecordPtrs.erase(this->headPtr);
-
-    // Copy the record to the storage and move the headPtr along
-    std::memcpy(this->headPtr, &r.tconst, sizeof(r.tconst));
-    this->headPtr += sizeof(r.tconst);
-
-    std::memcpy(this->headPtr, &r.averageRating, sizeof(r.averageRating));
-    this->headPtr += sizeof(r.averageRating);
-
-    std::memcpy(this->headPtr, &r.numVotes, sizeof(r.numVotes));
-    this->headPtr += sizeof(r.numVotes);
-
-    // Point to the start of new block to accommodate the next insertion
-    if (this->getBlockOffset(this->headPtr) + this->recordSize > blockSize) {
-        this->headPtr = this->storagePtr + this->usedBlocks * this->blockSize;
-    }
+    this->setOccupied(blockIdx, slot, true);
+    this->updateFreeSpace(blockIdx, this->recordsPerBlock - records, this->recordsPerBlock - records - 1);
 
     // Update used size
     this->usedSize += this->recordSize;
@@ -248,23 +1301,140 @@ std::byte* Storage::insertRecord(Record r) {
  * @brief Delete a specified record from the storage
  * 
  * @param startPtr Starting byte of the record
- * @return A pointer to the starting byte that is deleted, or NULL if startPtr is invalid or the location is not occupied
- * @throw std::invalid_argument if the starting pointer is invalid
+ * @throw std::invalid_argument if the starting pointer is invalid or the location is not occupied
  */
 void Storage::deleteRecord(std::byte* startPtr) {
-    if (!this->isValidStartPtr(startPtr) || this->availableRecordPtrs.count(startPtr)) {
+    if (!this->isValidStartPtr(startPtr) || !this->isOccupied(this->getBlockIndex(startPtr), this->getSlotIndex(startPtr))) {
         throw std::invalid_argument("Invalid starting pointer");
     }
 
-    if (this->headPtr == NULL) {
-        this->headPtr = startPtr;
-    }
+    int blockIdx = this->getBlockIndex(startPtr);
+    int records = this->countRecords(blockIdx);
 
     // Update markings
-    this->availableRecordPtrs.insert(startPtr);
+    this->tconstIndex.remove(RecordView(startPtr, this).tconst(), this->getRecordId(startPtr));
+    this->shrinkZoneMap(blockIdx, startPtr, records == 1);
+    this->setOccupied(blockIdx, this->getSlotIndex(startPtr), false);
+    this->updateFreeSpace(blockIdx, this->recordsPerBlock - records, this->recordsPerBlock - records + 1);
 
     // Clear contents
-    std::memset(startPtr, 0x00, this->recordSize);
+    this->clearRecord(startPtr);
     // Update used size
     this->usedSize -= this->recordSize;
+
+    // Block emptied
+    if (records == 1) {
+        this->usedBlocks--;
+    }
+}
+
+/**
+ * @brief Delete records a block at a time, in block order: the occupancy and free-space map
+ * of each block are updated once for all of its deleted records
+ * 
+ * @param startPtrs Starting bytes of the records, in any order
+ * @throw std::invalid_argument if a starting pointer is invalid, not occupied or given twice,
+ * in which case no record is deleted
+ */
+void Storage::deleteRecords(const std::vector<std::byte *> &startPtrs) {
+    std::vector<std::byte *> sortedPtrs(startPtrs);
+    std::sort(sortedPtrs.begin(), sortedPtrs.end());
+    for (size_t i = 0; i < sortedPtrs.size(); i++) {
+        std::byte *startPtr = sortedPtrs[i];
+        if (!this->isValidStartPtr(startPtr) || !this->isOccupied(this->getBlockIndex(startPtr), this->getSlotIndex(startPtr))
+            || (i > 0 && startPtr == sortedPtrs[i - 1])) {
+            throw std::invalid_argument("Invalid starting pointer");
+        }
+    }
+
+    for (size_t i = 0; i < sortedPtrs.size();) {
+        int blockIdx = this->getBlockIndex(sortedPtrs[i]);
+        int records = this->countRecords(blockIdx);
+        int deleted = 0;
+        for (; i < sortedPtrs.size() && this->getBlockIndex(sortedPtrs[i]) == blockIdx; i++, deleted++) {
+            this->tconstIndex.remove(RecordView(sortedPtrs[i], this).tconst(), this->getRecordId(sortedPtrs[i]));
+            this->shrinkZoneMap(blockIdx, sortedPtrs[i], records == deleted + 1);
+            this->setOccupied(blockIdx, this->getSlotIndex(sortedPtrs[i]), false);
+            this->clearRecord(sortedPtrs[i]);
+        }
+        this->updateFreeSpace(blockIdx, this->recordsPerBlock - records, this->recordsPerBlock - records + deleted);
+        this->usedSize -= deleted * this->recordSize;
+
+        // Block emptied
+        if (records == deleted) {
+            this->usedBlocks--;
+        }
+    }
+}
+
+/**
+ * @brief Construct a new BlockWriter object, it claims its first block on the first insert
+ * 
+ * @param storage Storage to insert into
+ */
+BlockWriter::BlockWriter(Storage &storage) {
+    this->storage = &storage;
+    this->blockIdx = -1;
+    this->slot = 0;
+}
+
+/**
+ * @brief Give back the block being filled, its free slots become available to other inserts
+ */
+BlockWriter::~BlockWriter() {
+    this->releaseBlock();
+}
+
+/**
+ * @brief Add the records of the block being filled to the tconst index, and the block to the
+ * free-space map if it still has free slots
+ */
+void BlockWriter::releaseBlock() {
+    if (this->blockIdx == -1) {
+        return;
+    }
+    Storage *storage = this->storage;
+    std::lock_guard<std::mutex> lock(storage->freeSpaceMutex);
+    // The writer filled the first slots of its block
+    std::byte *startBlockPtr = storage->storagePtr + (long) this->blockIdx * storage->blockSize;
+    for (int slot = 0; slot < this->slot; slot++) {
+        storage->tconstIndex.insert(RecordView(startBlockPtr + slot * storage->recordSize, storage).tconst(), (RecordId) this->blockIdx << 32 | slot);
+        storage->widenZoneMap(this->blockIdx, startBlockPtr + slot * storage->recordSize);
+    }
+    if (this->slot < storage->recordsPerBlock) {
+        storage->updateFreeSpace(this->blockIdx, 0, storage->recordsPerBlock - this->slot);
+    }
+    this->blockIdx = -1;
+}
+
+/**
+ * @brief Insert a record into the block this writer fills, claiming a new block once it is full
+ * 
+ * @param r Record 
+ * @return A pointer to the starting byte of the record 
+ * @throw std::runtime_error if the storage is already full
+ */
+std::byte* BlockWriter::insertRecord(const Record &r) {
+    Storage *storage = this->storage;
+    if (this->blockIdx == -1 || this->slot == storage->recordsPerBlock) {
+        // A full block is in no list of the free-space map, its records still join the tconst index
+        this->releaseBlock();
+        this->blockIdx = storage->claimBlock();
+        this->slot = 0;
+        if (this->blockIdx == -1) {
+            throw std::runtime_error("Storage is already full");
+        }
+        storage->usedBlocks++;
+    }
+
+    std::byte *startPtr = storage->storagePtr + (long) this->blockIdx * storage->blockSize + this->slot * storage->recordSize;
+    storage->writeRecord(startPtr, r);
+
+    // Neighbouring blocks share words of the occupancy bitmap
+    long bit = (long) this->blockIdx * storage->recordsPerBlock + this->slot;
+    __atomic_fetch_or(&storage->occupiedSlots[bit / 64], (uint64_t) 1 << (bit % 64), __ATOMIC_RELAXED);
+    storage->usedSize += storage->recordSize;
+    this->slot++;
+
+    return startPtr;
 }
@@ -1,9 +1,15 @@
 #pragma once
 #include <cstddef>
+#include <cstdint>
 #include <unordered_set>
+#include <unordered_map>
 #include <vector>
 #include <tuple>
 #include <string>
+#include <string_view>
+#include <stdexcept>
+#include <atomic>
+#include <mutex>
 
 struct Record {
     char tconst[10];
@@ -11,44 +17,286 @@ struct Record {
     int numVotes;
 };
 
+class Storage;
+
+// Read-only view of a record in place in its block, each field is read (and decoded) when
+// accessed without copying the record
+class RecordView {
+    private:
+        const std::byte *ptr;
+        const Storage *storage;
+    public:
+        RecordView(const std::byte *ptr, const Storage *storage);
+        std::string tconst() const;
+        float averageRating() const;
+        int numVotes() const;
+        Record toRecord() const;
+};
+
+// Identifies a record by its block (high 32 bits) and slot (low 32 bits), unlike a pointer
+// it stays valid when the storage is reopened
+typedef uint64_t RecordId;
+
+// Primary-key hash index from the tconst of a record to its record id, with open addressing
+// and linear probing. The tconsts are stored inline in the table, so a lookup compares keys
+// without reading any block. tconsts are expected to be unique, a duplicate gets an entry of
+// its own and a lookup finds one of them.
+class TconstIndex {
+    private:
+        struct Entry {
+            // tconst padded with zeros
+            char tconst[sizeof(Record::tconst)];
+            // Record id, EMPTY_ENTRY if the entry is free
+            RecordId recordId;
+        };
+
+        // Power of two number of entries
+        std::vector<Entry> entries;
+        // Number of entries in use
+        size_t noOfEntries;
+
+        static bool makeKey(std::string_view tconst, char *key);
+        size_t getHomeEntry(const char *key);
+        void grow();
+    public:
+        TconstIndex();
+        void insert(std::string_view tconst, RecordId recordId);
+        void remove(std::string_view tconst, RecordId recordId);
+        bool find(std::string_view tconst, RecordId &recordId);
+        void clear();
+        size_t getNoOfEntries();
+};
+
+// How the fields of a record are stored in a block
+enum RecordEncoding {
+    // tconst as text (10 bytes), float averageRating, int numVotes: 18 bytes
+    TEXT_RECORDS,
+    // tconst encoded in 4 bytes, float averageRating, int numVotes: 12 bytes
+    COMPACT_TCONST,
+    // tconst encoded in 4 bytes, averageRating in tenths in 2 bytes, int numVotes: 10 bytes
+    COMPACT_RECORDS
+};
+
+// How the records of a block are laid out
+enum BlockLayout {
+    // Records one after the other, each with all of its fields
+    ROW_BLOCKS,
+    // PAX: a minipage per field (numVotes, averageRating, tconst), each holding that field of
+    // every slot of the block, so that a scan over a field reads contiguous, aligned values
+    PAX_BLOCKS
+};
+
+// Minipages of a PAX block, slot i of the block holds element i of each of them
+struct BlockColumns {
+    const int *numVotes;
+    // averageRating of the float encodings, NULL for COMPACT_RECORDS
+    const float *averageRatings;
+    // averageRating in tenths of COMPACT_RECORDS, NULL otherwise
+    const uint16_t *ratingTenths;
+};
+
+// Smallest and largest numVotes and averageRating of the records of a block, the minimums are
+// above the maximums for a block without records. A scan skips a block whose ranges do not
+// overlap its predicate.
+struct ZoneMap {
+    int minNumVotes;
+    int maxNumVotes;
+    float minAverageRating;
+    float maxAverageRating;
+};
+
+// Which block with free space an insertion goes to
+enum FreeSpacePolicy {
+    // Block with the lowest index
+    FIRST_FIT,
+    // Block with the fewest free slots, so partially empty blocks fill up before emptier ones
+    MOST_FULL_FIRST
+};
+
 class Storage {
+    friend class BlockWriter;
+    friend class RecordView;
+    friend class TableScan;
+
     private:
         // Storage size (bytes)
         int size;
         // Used storage size (bytes)
-        int usedSize;
+        std::atomic<int> usedSize;
 
         // Block size (bytes)
         int blockSize;
         // Record size (bytes)
         int recordSize;
+        // Format of the records and layout of the blocks
+        RecordEncoding encoding;
+        BlockLayout layout;
+        // Offset of each field within a record in a row block, or of its minipage in a PAX block,
+        // and size of the field
+        int tconstOffset;
+        int tconstSize;
+        int averageRatingOffset;
+        int averageRatingSize;
+        int numVotesOffset;
+
+        // Encoded records: tconsts that are not "tt" and 1 to 8 digits, the code of such a
+        // tconst is ENCODED_TCONST_OVERFLOW with its index here
+        std::vector<std::string> overflowTconsts;
+        // Index of each tconst in overflowTconsts
+        std::unordered_map<std::string, uint32_t> overflowCodes;
+        // File the overflow tconsts of a file-backed storage are kept in, next to the data file
+        std::string overflowPath;
 
         // Number of blocks that contain at least 1 record
-        int usedBlocks;
+        std::atomic<int> usedBlocks;
+
+        // Number of blocks in the storage
+        int noOfBlocks;
+        // Number of record slots in a block (records never span 2 blocks)
+        int recordsPerBlock;
+
+        // Occupancy bitmap, 1 bit per record slot (bit blockIdx * recordsPerBlock + slot),
+        // covering every block so that it never moves while writers insert
+        std::vector<uint64_t> occupiedSlots;
+        // Index of the first block that was never used
+        std::atomic<int> nextUnusedBlock;
+
+        // Free-space map of the blocks taken into use, inserts go to a block with free
+        // slots before a block that was never used
+        FreeSpacePolicy policy;
+        // FIRST_FIT: bitmap of the blocks with at least 1 free slot
+        std::vector<uint64_t> blocksWithSpace;
+        // FIRST_FIT: no word of blocksWithSpace before this one has a bit set
+        int firstWordWithSpace;
+        // MOST_FULL_FIRST: blocksByFreeSlots[k] lists the blocks with exactly k free slots
+        std::vector<std::vector<int>> blocksByFreeSlots;
+        // MOST_FULL_FIRST: position of each block in its list of blocksByFreeSlots
+        std::vector<int> freeSlotsListPos;
+        // Guards the free-space map and the tconst index while block writers give back their blocks
+        std::mutex freeSpaceMutex;
 
-        // Store the starting pointers of available spaces for records 
-        std::unordered_set<std::byte*> availableRecordPtrs;
+        // Record id of every record by tconst, rebuilt from the blocks when a data file is reopened
+        TconstIndex tconstIndex;
+
+        // Zone map of every block, widened by inserts. A delete of a record at a bound of its
+        // block marks the zone map stale, and a stale zone map is rebuilt from the block when it
+        // is next read. Zone maps are not kept in a data file and all start stale on reopen.
+        std::vector<ZoneMap> zoneMaps;
+        // 1 if the zone map of the block is stale (a byte per block, so that scans on several
+        // threads can rebuild the zone maps of their own blocks)
+        std::vector<uint8_t> staleZoneMaps;
 
         // Pointer to the first byte of the storage
         std::byte *storagePtr;
-        // Pointer to the starting byte to insert a record
-        std::byte *headPtr;
+
+        // Descriptor of the data file, -1 if the storage lives in memory only
+        int fd;
+        // Mapping of the whole data file (header, occupancy bitmap, blocks), NULL if in memory
+        std::byte *mappedPtr;
+        // Size of the mapping (bytes)
+        size_t mappedSize;
         
         bool isValidStartPtr(std::byte* startPtr);
         int getBlockOffset(std::byte* startPtr);
         int getBlockIndex(std::byte* startPtr);
+        int getSlotIndex(std::byte* startPtr);
+        bool isOccupied(int blockIdx, int slot);
+        void setOccupied(int blockIdx, int slot, bool occupied);
+        int findFreeSlot(int blockIdx);
+        int countRecords(int blockIdx);
+        int claimBlock();
+        int takeUnusedBlock();
+        int findBlockWithSpace();
+        void updateFreeSpace(int blockIdx, int oldFreeSlots, int newFreeSlots);
+        void initLayout(int size, int blockSize, RecordEncoding encoding, BlockLayout layout, FreeSpacePolicy policy);
+        size_t getBitmapRegionSize();
+        void loadFileState();
+        void prefetchBlock(int blockIdx);
+        uint32_t encodeTconst(std::string_view tconst);
+        std::string decodeTconst(uint32_t code) const;
+        std::byte* getFieldPtr(const std::byte *startPtr, int fieldOffset, int fieldSize) const;
+        void writeRecord(std::byte *startPtr, const Record &r);
+        void clearRecord(std::byte *startPtr);
+        void widenZoneMap(int blockIdx, const std::byte *startPtr);
+        void shrinkZoneMap(int blockIdx, const std::byte *startPtr, bool blockEmptied);
+        void rebuildZoneMap(int blockIdx);
+        void loadOverflowTconsts(int noOfOverflowTconsts);
     public:
-        Storage(int size, int blockSize, int recordSize);
+        Storage(int size, int blockSize, RecordEncoding encoding = TEXT_RECORDS, BlockLayout layout = ROW_BLOCKS, FreeSpacePolicy policy = FIRST_FIT);
+        Storage(const char *path, int size, int blockSize, RecordEncoding encoding = TEXT_RECORDS, BlockLayout layout = ROW_BLOCKS, FreeSpacePolicy policy = FIRST_FIT);
         ~Storage();
+        void sync();
         int getSize();
         int getBlockSize();
         int getRecordSize();
+        RecordEncoding getEncoding();
+        BlockLayout getLayout();
+        BlockColumns getBlockColumns(int blockIdx);
+        ZoneMap getZoneMap(int blockIdx);
         int getUsedBlocks();
         int getUsedSize();
         std::byte* getStoragePtr();
+        RecordId getRecordId(std::byte* startPtr);
+        std::byte* getRecordPtr(RecordId recordId);
         std::vector<std::string> getBlockContent(int blockIdx);
         std::tuple<Record, int> getRecord(std::byte* startPtr);
-        std::tuple<std::vector<Record>, std::vector<int>> getRecords(std::vector<std::byte *> startPtrs); 
+        std::tuple<std::vector<Record>, std::vector<int>> getRecords(const std::vector<std::byte *> &startPtrs, bool blockOrder = false);
+        RecordView viewRecord(std::byte* startPtr);
+        template <typename Visitor>
+        void visitRecord(std::byte *startPtr, Visitor &&visit);
+        template <typename Visitor>
+        void visitRecords(const std::vector<std::byte *> &startPtrs, Visitor &&visit);
+        std::vector<std::byte *> getAllRecordPtrs();
+        std::byte* findRecord(std::string_view tconst);
         std::byte* insertRecord(Record r);
         void deleteRecord(std::byte* startPtr);
+        void deleteRecords(const std::vector<std::byte *> &startPtrs);
+};
+
+// Inserts records into blocks it claims for itself, a block at a time, so that several
+// threads can insert into the same storage at once, each with its own writer, without a lock.
+// Other storage operations must not run while writers insert.
+class BlockWriter {
+    private:
+        Storage *storage;
+        // Block being filled, -1 if none
+        int blockIdx;
+        // Next slot of the block to fill
+        int slot;
+        void releaseBlock();
+    public:
+        BlockWriter(Storage &storage);
+        ~BlockWriter();
+        BlockWriter(const BlockWriter &) = delete;
+        BlockWriter &operator=(const BlockWriter &) = delete;
+        std::byte* insertRecord(const Record &r);
 };
+
+/**
+ * @brief Visit a record in place, without copying it
+ * 
+ * @param startPtr A pointer to the first byte of the record
+ * @param visit Called as visit(RecordView, block index)
+ * @throw std::invalid_argument if the starting pointer is invalid
+ */
+template <typename Visitor>
+void Storage::visitRecord(std::byte *startPtr, Visitor &&visit) {
+    if (!this->isValidStartPtr(startPtr) || !this->isOccupied(this->getBlockIndex(startPtr), this->getSlotIndex(startPtr))) {
+        throw std::invalid_argument("Invalid starting pointer");
+    }
+    visit(RecordView(startPtr, this), this->getBlockIndex(startPtr));
+}
+
+/**
+ * @brief Visit records in place, without copying them or allocating
+ * 
+ * @param startPtrs Vector of pointers to the first byte of records
+ * @param visit Called as visit(RecordView, block index) for each record, in order
+ * @throw std::invalid_argument if a starting pointer is invalid
+ */
+template <typename Visitor>
+void Storage::visitRecords(const std::vector<std::byte *> &startPtrs, Visitor &&visit) {
+    for (std::byte *startPtr: startPtrs) {
+        this->visitRecord(startPtr, visit);
+    }
+}